@@ -0,0 +1,33 @@
+// Offline texture cooker. Writes the cache/ entries that texture_load_batch
+// would otherwise create on first launch.
+//
+//   ./cook textures/*.jpg textures/*.png
+//   ./cook --rgba8 textures/terrain_splatmap.png
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "texture_cache.h"
+
+int main(int argc, char** argv) {
+    auto cook   = TEXTURE_COOK_COMPRESSED;
+    auto failed = false;
+
+    for (auto i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rgba8") == 0) {
+            cook = TEXTURE_COOK_RGBA8;
+            continue;
+        }
+
+        TextureImage image{};
+        if (!texture_cache_load(argv[i], cook, &image)) {
+            fprintf(stderr, "Cooking texture failed: '%s'\n", argv[i]);
+            failed = true;
+            continue;
+        }
+
+        printf("%s -> %s (%dx%d, %d levels, %zu bytes)\n", argv[i],
+               texture_cache_path(argv[i], cook).c_str(), image.width,
+               image.height, image.level_count, image.data.size());
+    }
+
+    return failed ? 1 : 0;
+}
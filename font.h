@@ -4,81 +4,576 @@
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_MODULE_H
 
+#include "hash.h"
 #include "shader.h"
+#include "string.h"
+
+// Text is not drawn right away. font_draw appends the quads of its glyphs to
+// a batch per atlas, and font_flush draws each batch once all text is queued.
+//
+// Most text is the same from one frame to the next, so a string is laid out
+// once and its quads kept in a slot of a static vertex buffer, keyed by the
+// font, string, position and color. Later draws of it only add the slot to a
+// glMultiDrawArrays. Strings that are too long for a slot, or that find every
+// slot in use this frame, are laid out again into a streaming buffer.
+
+// Cached strings, the least recently drawn string gives up its slot
+#define FONT_CACHE_SLOTS 64
+#define FONT_CACHE_SLOT_GLYPHS 48
+#define FONT_CACHE_SLOT_VERTICES (6 * FONT_CACHE_SLOT_GLYPHS)
+// Widths remembered, the least recently measured string gives up its entry
+#define FONT_WIDTH_MEMO 256
+
+struct FontVertex {
+    glm::vec2 position;
+    glm::vec2 uv;
+    glm::vec4 color;
+};
+
+// A string in a slot of the cache buffer
+struct FontMesh {
+    u64 key;       // 0 while the slot is free
+    int count;     // Vertices
+    u64 last_used; // Frame the string was last drawn in
+};
+
+// The width of a string, as measured by font_width
+struct FontWidth {
+    float width;
+    u64 last_used; // Frame the width was last asked for
+};
+
+// Everything drawn from one atlas this frame
+struct FontBatch {
+    unsigned int atlas;
+    std::vector<FontVertex> vertices; // Streamed quads
+    std::vector<GLint> firsts;        // Cached meshes
+    std::vector<GLsizei> counts;
+};
+
+struct FontStats {
+    int draw_calls;      // Draw calls issued by font_flush
+    int glyphs;          // Glyphs drawn, one draw call each without batching
+    int cache_hits;      // Strings drawn from the cache
+    int cache_misses;    // Strings laid out this frame
+    int glyphs_rendered; // Glyphs rendered into an atlas
+    double time;         // CPU seconds spent laying out and drawing text
+};
+
+struct FontRenderer {
+    unsigned int VAO, VBO;
+    size_t capacity; // Vertices the streaming VBO has room for
+    std::vector<FontBatch> batches;
+
+    unsigned int cache_VAO, cache_VBO;
+    FontMesh meshes[FONT_CACHE_SLOTS];
+    std::unordered_map<u64, int> mesh_slots; // Slot of every cached string
+    std::unordered_map<u64, FontWidth> widths;
+    u64 frame_index;
+
+    FontStats frame;      // Counted so far this frame
+    FontStats last_frame; // Counted during the previous frame
+};
+
+// Glyphs are rendered at this pixel size, and their distance fields reach this
+// many pixels out from the outline. The spread bounds how far a font can be
+// scaled before its edges lose their antialiasing.
+#define FONT_SDF_SIZE 48
+#define FONT_SDF_SPREAD 8
 
 FT_Library ft_lib;
 Shader font_shader;
+ShaderUniform<int> font_text;
+FontRenderer font_renderer;
 
-static void font_init() {
-    if (FT_Init_FreeType(&ft_lib)) {
-        error("FreeType init failed!\n");
-    }
+// Call again whenever font_shader has been rebuilt
+static void font_resolve_uniforms() {
+    font_text = shaderUniform<int>(font_shader, "text");
+}
+
+// Set up a vertex array reading FontVertex from buffer
+static void font_vertex_array(unsigned int vertex_array, unsigned int buffer) {
+    gl_state_bind_vertex_array(vertex_array);
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(FontVertex), 0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(FontVertex),
+                          (void*)offsetof(FontVertex, color));
+}
 
-    shaderCompile(font_shader, "shaders/text.vert", "shaders/text.frag");
+static void font_init() {
+    // Finished along with the other startup programs, resolve the uniforms
+    // once it is built
+    shaderCompileStart(font_shader, "shaders/text.vert", "shaders/text.frag");
 
-    glEnable(GL_BLEND);
+    gl_state_enable(GL_BLEND, true);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glGenVertexArrays(1, &font_renderer.VAO);
+    glGenBuffers(1, &font_renderer.VBO);
+    font_vertex_array(font_renderer.VAO, font_renderer.VBO);
+
+    glGenVertexArrays(1, &font_renderer.cache_VAO);
+    glGenBuffers(1, &font_renderer.cache_VBO);
+    font_vertex_array(font_renderer.cache_VAO, font_renderer.cache_VBO);
+    glBufferData(GL_ARRAY_BUFFER,
+                 FONT_CACHE_SLOTS * FONT_CACHE_SLOT_VERTICES *
+                     sizeof(FontVertex),
+                 NULL, GL_DYNAMIC_DRAW);
 }
 
-struct Font {
-    FT_Face face;
+// Glyphs are rendered into a fixed size atlas as they are first drawn, each
+// into a cell of a grid. Once every cell is taken, the glyph drawn least
+// recently gives up its cell.
+#define FONT_ATLAS_SIZE 1024
+#define FONT_ATLAS_CELL 80 // Fits a glyph with its spread and padding
+#define FONT_ATLAS_COLUMNS (FONT_ATLAS_SIZE / FONT_ATLAS_CELL)
+#define FONT_ATLAS_CELLS (FONT_ATLAS_COLUMNS * FONT_ATLAS_COLUMNS)
+// Empty texels around every glyph, so linear filtering stays inside it
+#define FONT_ATLAS_PADDING 1
+#define FONT_NO_CELL -1
+
+// The distance fields and metrics of the glyphs rendered so far are appended
+// to a file in cache/fonts/, one per font file, named after a hash of it. A
+// start that only draws glyphs found there never starts FreeType. Every size
+// of a font draws from the same glyphs, so one file covers them all.
+//
+// Only the metrics are read at startup. A distance field is read from the file
+// when its glyph is given a cell, and let go of once it is in the atlas, so
+// memory only holds the fields that have not been appended yet.
+#define FONT_GLYPH_CACHE_DIRECTORY "cache/fonts/"
+#define FONT_GLYPH_CACHE_VERSION 2
+// Seconds the glyphs rendered since the last save wait to be saved together,
+// so that new text does not write the file on every frame that shows it
+#define FONT_GLYPH_CACHE_SAVE_DELAY 5.0
+// Bytes of unsaved glyphs that are saved right away, without the delay
+#define FONT_GLYPH_CACHE_UNSAVED_BYTES (256 * 1024)
+
+struct FontGlyphCacheHeader {
+    u64 key;
+};
+
+// Follows the header once for every save of a glyph, the last one counts. A
+// rendered glyph is followed by its distance field, size.x by size.y bytes.
+struct FontGlyphCacheEntry {
+    u32 code_point;
+    float advance;
+    u32 rendered; // Whether the fields below are known
+    u32 empty;
+    glm::vec2 size;
+    glm::vec2 bearing;
+};
 
-    struct Character {
-        unsigned int texture;
-        glm::vec2 size;
+// A font file with its glyphs rendered as signed distance fields into an
+// atlas that every size of the font draws from
+struct Typeface {
+    std::string filename;
+    String file;  // FreeType reads the face from memory
+    u64 key;      // Hash of the file, names its glyph cache
+    FT_Face face; // nullptr until a glyph is missing from the cache
+
+    struct Glyph {
+        glm::vec4 rect; // Texture coordinates in the atlas: x, y, width, height
+        glm::vec2 size; // Pixels at FONT_SDF_SIZE, like bearing and advance
         glm::vec2 bearing;
         float advance;
+        bool empty;    // Nothing to draw, such as a space
+        bool rendered; // Whether its size, bearing and distance field are known
+        bool stored;   // Whether the glyph cache holds the glyph as it is now
+        bool unsaved;  // Whether it waits in Typeface::unsaved
+        u64 bitmap;    // Offset of the distance field in the glyph cache
+        // The distance field while it is not in the glyph cache, or on its way
+        // into the atlas
+        std::vector<u8> field;
+        int cell;      // FONT_NO_CELL while not in the atlas
+        u64 last_used; // Frame the glyph was last drawn in
     };
 
-    std::map<char, Character> characters;
-    unsigned int VAO, VBO;
+    // Every glyph looked up so far by its code point. The metrics are kept
+    // after a glyph has lost its cell.
+    std::unordered_map<u32, Glyph> glyphs;
+    int cached_glyphs; // Glyphs read from the glyph cache
+
+    FILE* cache;       // The glyph cache, opened by the first load or save
+    bool cache_failed; // Writing failed, glyphs are rendered again instead
+    std::vector<u32> unsaved; // Code points to append with the next save
+    u64 unsaved_bytes;
+    std::chrono::steady_clock::time_point unsaved_since;
+
+    u32 cells[FONT_ATLAS_CELLS]; // Code point of the glyph in every cell
+    int cells_used;              // Cells handed out, from the first one
+
+    // Changes whenever a cell is given to another glyph, which makes the
+    // texture coordinates laid out before it stale
+    u32 generation;
+    unsigned int atlas; // Single channel, FONT_ATLAS_SIZE squared
 };
 
-static void font_load(Font* font, const char* filename, int size) {
-    if (auto ec = FT_New_Face(ft_lib, filename, 0, &font->face); ec) {
-        error("FreeType load font failed: '%s'\n", filename);
+// One typeface of a size
+struct Font {
+    Typeface* typeface;
+    float scale; // Pixel size over FONT_SDF_SIZE
+};
+
+// Every typeface loaded, each file is only loaded once
+std::vector<std::unique_ptr<Typeface>> font_typefaces;
+
+// The FreeType face of a typeface, FreeType is started when the first face is
+// needed
+static FT_Face font_face(Typeface* typeface) {
+    if (typeface->face) return typeface->face;
+
+    if (!ft_lib) {
+        if (FT_Init_FreeType(&ft_lib)) {
+            error("FreeType init failed!\n");
+        }
+
+        FT_Int spread = FONT_SDF_SPREAD;
+        if (FT_Property_Set(ft_lib, "sdf", "spread", &spread)) {
+            error("FreeType has no signed distance field renderer!\n");
+        }
+    }
+
+    if (FT_New_Memory_Face(ft_lib, (const FT_Byte*)typeface->file.data,
+                           typeface->file.length, 0, &typeface->face)) {
+        error("FreeType load font failed: '%s'\n", typeface->filename.c_str());
+    }
+    FT_Set_Pixel_Sizes(typeface->face, 0, FONT_SDF_SIZE);
+    return typeface->face;
+}
+
+// Have a glyph that changed appended to the glyph cache by the next save
+static void font_glyph_unsave(Typeface* typeface, u32 code_point,
+                              Typeface::Glyph* glyph) {
+    glyph->stored = false;
+    if (typeface->cache_failed) return;
+
+    typeface->unsaved_bytes += sizeof(FontGlyphCacheEntry) +
+                               glyph->field.size();
+    if (glyph->unsaved) return;
+
+    if (typeface->unsaved.empty())
+        typeface->unsaved_since = std::chrono::steady_clock::now();
+    glyph->unsaved = true;
+    typeface->unsaved.push_back(code_point);
+}
+
+// The glyph of a code point, with only its advance loaded until it is drawn
+static Typeface::Glyph* font_glyph(Typeface* typeface, u32 code_point) {
+    auto [it, added] = typeface->glyphs.try_emplace(code_point);
+    auto glyph       = &it->second;
+    if (!added) return glyph;
+
+    auto face = font_face(typeface);
+    if (FT_Load_Char(face, code_point, FT_LOAD_DEFAULT)) {
+        error("FreeType glyph failed!\n");
+    }
+    glyph->advance = (float)face->glyph->advance.x;
+    glyph->cell    = FONT_NO_CELL;
+    font_glyph_unsave(typeface, code_point, glyph);
+    return glyph;
+}
+
+// A cell for a new glyph, or FONT_NO_CELL if every glyph in the atlas is
+// drawn this frame
+static int font_atlas_cell(Typeface* typeface, u64 frame) {
+    if (typeface->cells_used < FONT_ATLAS_CELLS) return typeface->cells_used++;
+
+    auto cell                   = FONT_NO_CELL;
+    Typeface::Glyph* least_used = nullptr;
+    for (auto i = 0; i < FONT_ATLAS_CELLS; i++) {
+        auto glyph = &typeface->glyphs[typeface->cells[i]];
+        if (glyph->last_used == frame) continue;
+        if (!least_used || glyph->last_used < least_used->last_used) {
+            cell       = i;
+            least_used = glyph;
+        }
+    }
+
+    if (least_used) {
+        least_used->cell = FONT_NO_CELL;
+        typeface->generation++;
+    }
+    return cell;
+}
+
+// Render the distance field of a glyph with FreeType and keep it for the
+// atlas and the glyph cache. Also renders it again when the glyph cache
+// cannot give the field back.
+static void font_glyph_rasterize(Typeface* typeface, u32 code_point,
+                                 Typeface::Glyph* glyph) {
+    auto face = font_face(typeface);
+    auto slot = face->glyph;
+    if (FT_Load_Char(face, code_point, FT_LOAD_DEFAULT) ||
+        FT_Render_Glyph(slot, FT_RENDER_MODE_SDF)) {
+        error("FreeType glyph failed!\n");
+    }
+
+    // The bitmap and its bearing include the spread around the outline. The
+    // rare glyph larger than a cell is cut off.
+    auto bitmap     = &slot->bitmap;
+    auto limit      = FONT_ATLAS_CELL - 2 * FONT_ATLAS_PADDING;
+    auto w          = std::min((int)bitmap->width, limit);
+    auto h          = std::min((int)bitmap->rows, limit);
+    glyph->size     = glm::vec2(w, h);
+    glyph->bearing  = glm::vec2(slot->bitmap_left, slot->bitmap_top);
+    glyph->empty    = !w || !h;
+    glyph->rendered = true;
+    glyph->field.resize(w * h);
+    for (auto row = 0; row < h; row++) {
+        memcpy(&glyph->field[row * w], bitmap->buffer + row * bitmap->pitch,
+               w);
+    }
+    font_glyph_unsave(typeface, code_point, glyph);
+}
+
+// Read the distance field of a stored glyph back from the glyph cache
+static bool font_glyph_cache_read(Typeface* typeface, Typeface::Glyph* glyph) {
+    if (!typeface->cache || !glyph->stored) return false;
+
+    auto bytes = (size_t)glyph->size.x * (size_t)glyph->size.y;
+    glyph->field.resize(bytes);
+    return fseek(typeface->cache, (long)glyph->bitmap, SEEK_SET) == 0 &&
+           fread(glyph->field.data(), 1, bytes, typeface->cache) == bytes;
+}
+
+// Render a glyph into the atlas unless it already is. Returns whether the
+// glyph can be drawn, which it cannot while the atlas has no cell for it.
+static bool font_glyph_render(Typeface* typeface, u32 code_point,
+                              Typeface::Glyph* glyph, u64 frame,
+                              FontStats* stats) {
+    glyph->last_used = frame;
+    if (glyph->cell != FONT_NO_CELL) return true;
+
+    if (!glyph->rendered) font_glyph_rasterize(typeface, code_point, glyph);
+    if (glyph->empty) return true;
+
+    auto cell = font_atlas_cell(typeface, frame);
+    if (cell == FONT_NO_CELL) return false;
+
+    if (glyph->field.empty() && !font_glyph_cache_read(typeface, glyph))
+        font_glyph_rasterize(typeface, code_point, glyph);
+
+    // The whole cell is written, so the padding is cleared of the glyph that
+    // had the cell before
+    auto w      = (int)glyph->size.x;
+    auto h      = (int)glyph->size.y;
+    auto bitmap = glyph->field.data();
+    u8 pixels[FONT_ATLAS_CELL * FONT_ATLAS_CELL] = {};
+    for (auto row = 0; row < h; row++) {
+        memcpy(&pixels[(row + FONT_ATLAS_PADDING) * FONT_ATLAS_CELL +
+                       FONT_ATLAS_PADDING],
+               bitmap + row * w, w);
     }
 
-    FT_Set_Pixel_Sizes(font->face, 0, size);
+    auto x = cell % FONT_ATLAS_COLUMNS * FONT_ATLAS_CELL;
+    auto y = cell / FONT_ATLAS_COLUMNS * FONT_ATLAS_CELL;
+    gl_state_bind_texture(0, GL_TEXTURE_2D, typeface->atlas);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, FONT_ATLAS_CELL, FONT_ATLAS_CELL,
+                    GL_RED, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    // The save still needs the field of an unsaved glyph, the others can get
+    // it back when the glyph needs a cell again
+    if (!glyph->unsaved) std::vector<u8>().swap(glyph->field);
+
+    float size            = FONT_ATLAS_SIZE;
+    typeface->cells[cell] = code_point;
+    glyph->cell           = cell;
+    glyph->rect           = {(x + FONT_ATLAS_PADDING) / size,
+                             (y + FONT_ATLAS_PADDING) / size, w / size,
+                             h / size};
+    stats->glyphs_rendered++;
+    return true;
+}
+
+static std::string font_glyph_cache_path(u64 key) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return std::string(FONT_GLYPH_CACHE_DIRECTORY) + name;
+}
+
+// Read the metrics of the glyphs in the typeface's cache, if it has one that
+// matches the font file and the way glyphs are rendered, and keep it open to
+// read their distance fields from
+static void font_glyph_cache_load(Typeface* typeface) {
+    auto file = fopen(font_glyph_cache_path(typeface->key).c_str(), "r+b");
+    if (!file) return;
+
+    fseek(file, 0, SEEK_END);
+    u64 length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    FontGlyphCacheHeader header{};
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.key != typeface->key) {
+        fclose(file);
+        return;
+    }
+
+    // Every entry and distance field has to lie inside the file and fit a
+    // cell, or none of the file is used and the glyphs are rendered again
+    std::vector<std::pair<FontGlyphCacheEntry, u64>> loaded;
+    u64 offset = sizeof(header);
+    while (offset < length) {
+        FontGlyphCacheEntry entry;
+        if (offset + sizeof(entry) > length ||
+            fread(&entry, sizeof(entry), 1, file) != 1) {
+            fclose(file);
+            return;
+        }
+        offset += sizeof(entry);
+
+        u64 bytes = 0;
+        if (entry.rendered) {
+            auto limit = FONT_ATLAS_CELL - 2 * FONT_ATLAS_PADDING;
+            auto w     = entry.size.x;
+            auto h     = entry.size.y;
+            if (!(w >= 0 && w <= limit && h >= 0 && h <= limit) ||
+                w != (int)w || h != (int)h) {
+                fclose(file);
+                return;
+            }
+            bytes = (u64)w * (u64)h;
+        }
+        if (offset + bytes > length) {
+            fclose(file);
+            return;
+        }
 
-    for (unsigned char c = 0; c < 128; c++) {
-        if (FT_Load_Char(font->face, c, FT_LOAD_RENDER)) {
-            error("FreeType glyph failed!\n");
+        loaded.push_back({entry, offset});
+        offset += bytes;
+        fseek(file, (long)offset, SEEK_SET);
+    }
+
+    for (auto& [entry, bitmap] : loaded) {
+        auto& glyph    = typeface->glyphs[entry.code_point];
+        glyph.advance  = entry.advance;
+        glyph.rendered = entry.rendered;
+        glyph.empty    = entry.empty;
+        glyph.size     = entry.size;
+        glyph.bearing  = entry.bearing;
+        glyph.bitmap   = bitmap;
+        glyph.stored   = true;
+        glyph.cell     = FONT_NO_CELL;
+    }
+    typeface->cached_glyphs = typeface->glyphs.size();
+    typeface->cache         = file;
+}
+
+// Give up on the glyph cache. The unsaved glyphs let go of their distance
+// fields like the others, and are rendered again when they need them.
+static void font_glyph_cache_fail(Typeface* typeface) {
+    fprintf(stderr, "Writing glyph cache failed: '%s'\n",
+            font_glyph_cache_path(typeface->key).c_str());
+
+    if (typeface->cache) fclose(typeface->cache);
+    typeface->cache        = nullptr;
+    typeface->cache_failed = true;
+    for (auto code_point : typeface->unsaved) {
+        auto& glyph   = typeface->glyphs[code_point];
+        glyph.stored  = false;
+        glyph.unsaved = false;
+        std::vector<u8>().swap(glyph.field);
+    }
+    typeface->unsaved.clear();
+    typeface->unsaved_bytes = 0;
+}
+
+// Append the glyphs that changed since the last save to the typeface's cache,
+// starting a new one if there is none that matches
+static void font_glyph_cache_store(Typeface* typeface) {
+    if (!typeface->cache) {
+        std::error_code ec;
+        std::filesystem::create_directories(FONT_GLYPH_CACHE_DIRECTORY, ec);
+
+        auto path       = font_glyph_cache_path(typeface->key);
+        typeface->cache = fopen(path.c_str(), "w+b");
+        FontGlyphCacheHeader header = {typeface->key};
+        if (!typeface->cache ||
+            fwrite(&header, sizeof(header), 1, typeface->cache) != 1) {
+            font_glyph_cache_fail(typeface);
+            return;
         }
+    }
 
-        unsigned int texture;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, font->face->glyph->bitmap.width,
-                     font->face->glyph->bitmap.rows, 0, GL_RED,
-                     GL_UNSIGNED_BYTE, font->face->glyph->bitmap.buffer);
+    auto file = typeface->cache;
+    fseek(file, 0, SEEK_END);
+    for (auto code_point : typeface->unsaved) {
+        auto& glyph = typeface->glyphs[code_point];
+        FontGlyphCacheEntry entry = {code_point, glyph.advance,
+                                     glyph.rendered, glyph.empty,
+                                     glyph.size, glyph.bearing};
+        if (fwrite(&entry, sizeof(entry), 1, file) != 1) {
+            font_glyph_cache_fail(typeface);
+            return;
+        }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        auto bytes  = glyph.rendered ? glyph.field.size() : 0;
+        auto bitmap = ftell(file);
+        if (bytes && fwrite(glyph.field.data(), 1, bytes, file) != bytes) {
+            font_glyph_cache_fail(typeface);
+            return;
+        }
+        glyph.bitmap  = bitmap;
+        glyph.stored  = true;
+        glyph.unsaved = false;
+        std::vector<u8>().swap(glyph.field);
+    }
+    fflush(file);
 
-        auto glyph     = font->face->glyph;
-        auto character = Font::Character{
-            texture, glm::vec2(glyph->bitmap.width, glyph->bitmap.rows),
-            glm::vec2(glyph->bitmap_left, glyph->bitmap_top),
-            (float)glyph->advance.x};
-        font->characters.insert(std::make_pair(c, character));
+    typeface->unsaved.clear();
+    typeface->unsaved_bytes = 0;
+}
+
+static void font_typeface_load(Typeface* typeface, const char* filename) {
+    typeface->filename = filename;
+    if (!file_read(filename, typeface->file)) {
+        error("Loading font failed: '%s'\n", filename);
     }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // The glyphs cached for another version of the file, or rendered
+    // differently, are of no use
+    int rendering[] = {FONT_GLYPH_CACHE_VERSION, FONT_SDF_SIZE, FONT_SDF_SPREAD,
+                       FONT_ATLAS_CELL,          FONT_ATLAS_PADDING,
+                       FREETYPE_MAJOR,           FREETYPE_MINOR,
+                       FREETYPE_PATCH};
+    typeface->key = hash_fnv1a(typeface->file.data, typeface->file.length);
+    typeface->key = hash_fnv1a(rendering, sizeof(rendering), typeface->key);
+    font_glyph_cache_load(typeface);
+
+    // Filled in by font_glyph_render as glyphs are drawn
+    glGenTextures(1, &typeface->atlas);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, typeface->atlas);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, FONT_ATLAS_SIZE, FONT_ATLAS_SIZE, 0,
+                 GL_RED, GL_UNSIGNED_BYTE, NULL);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
 
-    glGenVertexArrays(1, &font->VAO);
-    glGenBuffers(1, &font->VBO);
-    glBindVertexArray(font->VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, font->VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+// The typeface of a font file, loaded on first use
+static Typeface* font_typeface(const char* filename) {
+    for (auto& typeface : font_typefaces) {
+        if (typeface->filename == filename) return typeface.get();
+    }
+
+    font_typefaces.push_back(std::make_unique<Typeface>());
+    auto typeface = font_typefaces.back().get();
+    font_typeface_load(typeface, filename);
+    return typeface;
+}
+
+// Fonts of the same file share one typeface, whatever their size
+static void font_load(Font* font, const char* filename, int size) {
+    font->typeface = font_typeface(filename);
+    font->scale    = (float)size / FONT_SDF_SIZE;
 }
 
 void font_projection(float width, float height) {
@@ -87,58 +582,188 @@ void font_projection(float width, float height) {
     shaderSetMat4(font_shader, "projection", projection);
 }
 
+// Hash of the font and string, continued by font_draw with what else makes
+// the quads of a string differ
+static u64 font_key(Font* font, const char* message, u64 length) {
+    auto key = hash_fnv1a(&font->typeface, sizeof(font->typeface));
+    key      = hash_fnv1a(&font->scale, sizeof(font->scale), key);
+    return hash_fnv1a(message, length, key);
+}
+
 float font_width(Font* font, const char* message) {
-    auto scale = 1.0f;
+    auto start   = std::chrono::steady_clock::now();
+    auto len     = strlen(message);
+    auto key     = font_key(font, message, len);
+    auto& widths = font_renderer.widths;
+    if (auto it = widths.find(key); it != widths.end()) {
+        it->second.last_used = font_renderer.frame_index;
+        font_renderer.frame.time += shaderSeconds(start);
+        return it->second.width;
+    }
+
+    auto scale = font->scale;
     auto x     = 0.0f;
-    auto len   = strlen(message);
-    for (auto i = 0; i < len; i++) {
-        auto c  = (int)message[i];
-        auto ch = font->characters[c];
-        x += (ch.advance / 64.0f) * scale;
+    auto end   = message + len;
+    while (message < end) {
+        auto glyph = font_glyph(font->typeface, utf8_decode(&message, end));
+        x += (glyph->advance / 64.0f) * scale;
     }
 
+    if (widths.size() >= FONT_WIDTH_MEMO) {
+        auto least_used = widths.begin();
+        for (auto it = widths.begin(); it != widths.end(); it++) {
+            if (it->second.last_used < least_used->second.last_used)
+                least_used = it;
+        }
+        widths.erase(least_used);
+    }
+    widths[key] = {x, font_renderer.frame_index};
+    font_renderer.frame.time += shaderSeconds(start);
     return x;
 }
 
-void font_draw(Font* font, float x, float y, glm::vec3 color,
-               const char* message) {
-    shaderBind(font_shader);
-    shaderSetVec3(font_shader, "textColor", color);
-    shaderSetTexture(font_shader, "text", 0);
+static FontBatch* font_batch(unsigned int atlas) {
+    for (auto& batch : font_renderer.batches) {
+        if (batch.atlas == atlas) return &batch;
+    }
+    font_renderer.batches.push_back({atlas, {}, {}, {}});
+    return &font_renderer.batches.back();
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindVertexArray(font->VAO);
+// Append the quads of a UTF-8 string to vertices. Returns whether every glyph
+// is in them, which they are not if the atlas had no cell for one.
+static bool font_layout(Font* font, float x, float y, glm::vec4 color,
+                        const char* message, u64 length,
+                        std::vector<FontVertex>* vertices) {
+    auto typeface = font->typeface;
+    auto scale    = font->scale;
+    auto end      = message + length;
+    auto complete = true;
+    while (message < end) {
+        auto code_point = utf8_decode(&message, end);
+        auto glyph      = font_glyph(typeface, code_point);
+        auto advance    = (glyph->advance / 64.0f) * scale;
+        if (!font_glyph_render(typeface, code_point, glyph,
+                               font_renderer.frame_index,
+                               &font_renderer.frame)) {
+            complete = false;
+            x += advance;
+            continue;
+        }
+        if (glyph->empty) {
+            x += advance;
+            continue;
+        }
 
-    auto scale = 1.0f;
-    auto len   = strlen(message);
-    for (auto i = 0; i < len; i++) {
-        auto c  = (int)message[i];
-        auto ch = font->characters[c];
+        float xpos = x + glyph->bearing.x * scale;
+        float ypos = y - (glyph->size.y - glyph->bearing.y) * scale;
+
+        float w = glyph->size.x * scale;
+        float h = glyph->size.y * scale;
+
+        // The atlas rows run top down like the glyph bitmaps
+        auto& rect = glyph->rect;
+        float u0 = rect.x, u1 = rect.x + rect.z;
+        float v0 = rect.y, v1 = rect.y + rect.w;
 
-        float xpos = x + ch.bearing.x * scale;
-        float ypos = y - (ch.size.y - ch.bearing.y) * scale;
+        FontVertex quad[6] = {
+            {{xpos, ypos + h}, {u0, v0}, color},
+            {{xpos, ypos}, {u0, v1}, color},
+            {{xpos + w, ypos}, {u1, v1}, color},
 
-        float w = ch.size.x * scale;
-        float h = ch.size.y * scale;
+            {{xpos, ypos + h}, {u0, v0}, color},
+            {{xpos + w, ypos}, {u1, v1}, color},
+            {{xpos + w, ypos + h}, {u1, v0}, color}};
 
-        float vertices[6][4] = {
-            {xpos, ypos + h, 0.0f, 0.0f},    {xpos, ypos, 0.0f, 1.0f},
-            {xpos + w, ypos, 1.0f, 1.0f},
+        vertices->insert(vertices->end(), quad, quad + 6);
+        x += advance;
+    }
+    return complete;
+}
 
-            {xpos, ypos + h, 0.0f, 0.0f},    {xpos + w, ypos, 1.0f, 1.0f},
-            {xpos + w, ypos + h, 1.0f, 0.0f}};
+// A slot for a new string of count vertices, or -1 if it does not fit or
+// every slot is drawn from this frame
+static int font_cache_slot(int count) {
+    if (count > FONT_CACHE_SLOT_VERTICES) return -1;
+
+    auto slot = -1;
+    for (auto i = 0; i < FONT_CACHE_SLOTS; i++) {
+        auto& mesh = font_renderer.meshes[i];
+        if (!mesh.key) return i;
+        if (mesh.last_used == font_renderer.frame_index) continue;
+        if (slot < 0 || mesh.last_used < font_renderer.meshes[slot].last_used)
+            slot = i;
+    }
+
+    if (slot >= 0) {
+        font_renderer.mesh_slots.erase(font_renderer.meshes[slot].key);
+    }
+    return slot;
+}
 
-        glBindTexture(GL_TEXTURE_2D, ch.texture);
-        glBindBuffer(GL_ARRAY_BUFFER, font->VBO);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+void font_draw(Font* font, float x, float y, glm::vec3 color,
+               const char* message) {
+    auto start = std::chrono::steady_clock::now();
+    auto batch = font_batch(font->typeface->atlas);
+    auto rgba  = glm::vec4(color, 1.0f);
+    auto len   = strlen(message);
 
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        x += (ch.advance / 64.0f) * scale;
+    auto typeface = font->typeface;
+    auto key      = font_key(font, message, len);
+
+    // Quads laid out before a glyph lost its cell are not reused
+    key = hash_fnv1a(&typeface->generation, sizeof(typeface->generation), key);
+    key = hash_fnv1a(&x, sizeof(x), key);
+    key = hash_fnv1a(&y, sizeof(y), key);
+    key = hash_fnv1a(&rgba, sizeof(rgba), key);
+    if (!key) key = 1; // 0 marks free slots
+
+    auto& stats = font_renderer.frame;
+    if (auto it = font_renderer.mesh_slots.find(key);
+        it != font_renderer.mesh_slots.end()) {
+        auto& mesh     = font_renderer.meshes[it->second];
+        mesh.last_used = font_renderer.frame_index;
+
+        // Keep the glyphs of the string from losing their cells this frame
+        auto end = message + len;
+        while (message < end) {
+            auto glyph = font_glyph(typeface, utf8_decode(&message, end));
+            glyph->last_used = font_renderer.frame_index;
+        }
+
+        batch->firsts.push_back(it->second * FONT_CACHE_SLOT_VERTICES);
+        batch->counts.push_back(mesh.count);
+        stats.glyphs += mesh.count / 6;
+        stats.cache_hits++;
+        stats.time += shaderSeconds(start);
+        return;
+    }
+
+    auto first    = batch->vertices.size();
+    auto complete = font_layout(font, x, y, rgba, message, len,
+                                &batch->vertices);
+    auto count    = (int)(batch->vertices.size() - first);
+    stats.glyphs += count / 6;
+    stats.cache_misses++;
+
+    // Move the quads into the cache, unless it has no room for them. A string
+    // missing a glyph is laid out again next frame, when the glyph may get a
+    // cell, instead of being kept without it.
+    auto slot = complete ? font_cache_slot(count) : -1;
+    if (slot >= 0) {
+        font_renderer.meshes[slot] = {key, count, font_renderer.frame_index};
+        font_renderer.mesh_slots[key] = slot;
+
+        auto offset = slot * FONT_CACHE_SLOT_VERTICES;
+        gl_state_bind_buffer(GL_ARRAY_BUFFER, font_renderer.cache_VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(FontVertex),
+                        count * sizeof(FontVertex), &batch->vertices[first]);
+        batch->vertices.resize(first);
+        batch->firsts.push_back(offset);
+        batch->counts.push_back(count);
     }
 
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    stats.time += shaderSeconds(start);
 }
 
 void font_draw(Font* font, float x, float y, const char* message) {
@@ -159,4 +784,97 @@ void font_drawf(Font* font, float x, float y, const char* format, ...) {
     va_end(args);
 }
 
+// Draw the text queued since the last flush over everything drawn before
+static void font_flush() {
+    auto start = std::chrono::steady_clock::now();
+
+    size_t count = 0;
+    auto drawn   = false;
+    for (auto& batch : font_renderer.batches) {
+        count += batch.vertices.size();
+        drawn = drawn || !batch.vertices.empty() || !batch.counts.empty();
+    }
+
+    if (drawn) {
+        shaderBind(font_shader);
+        shaderSet(font_text, 0);
+    }
+
+    if (count) {
+        gl_state_bind_buffer(GL_ARRAY_BUFFER, font_renderer.VBO);
+
+        // Orphan the storage the previous frame drew from, so the driver can
+        // hand out fresh memory instead of waiting for those draws
+        font_renderer.capacity = std::max(font_renderer.capacity, count);
+        glBufferData(GL_ARRAY_BUFFER,
+                     font_renderer.capacity * sizeof(FontVertex), NULL,
+                     GL_STREAM_DRAW);
+    }
+
+    size_t first = 0;
+    for (auto& batch : font_renderer.batches) {
+        gl_state_bind_texture(0, GL_TEXTURE_2D, batch.atlas);
+
+        if (!batch.counts.empty()) {
+            gl_state_bind_vertex_array(font_renderer.cache_VAO);
+            glMultiDrawArrays(GL_TRIANGLES, batch.firsts.data(),
+                              batch.counts.data(), batch.counts.size());
+            font_renderer.frame.draw_calls++;
+        }
+
+        if (!batch.vertices.empty()) {
+            gl_state_bind_vertex_array(font_renderer.VAO);
+            gl_state_bind_buffer(GL_ARRAY_BUFFER, font_renderer.VBO);
+            glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(FontVertex),
+                            batch.vertices.size() * sizeof(FontVertex),
+                            batch.vertices.data());
+            glDrawArrays(GL_TRIANGLES, first, batch.vertices.size());
+            font_renderer.frame.draw_calls++;
+        }
+
+        first += batch.vertices.size();
+        batch.vertices.clear();
+        batch.firsts.clear();
+        batch.counts.clear();
+    }
+
+    font_renderer.frame.time += shaderSeconds(start);
+}
+
+// Keep the counts of the frame that ended and start counting the next
+static void font_end_frame() {
+    font_renderer.last_frame = font_renderer.frame;
+    font_renderer.frame      = {};
+    font_renderer.frame_index++;
+
+    // Keep the glyphs rendered for the next start, saving those rendered
+    // within a few seconds of each other together, unless they take up a lot
+    // of memory already
+    auto now = std::chrono::steady_clock::now();
+    for (auto& typeface : font_typefaces) {
+        if (typeface->unsaved.empty()) continue;
+
+        std::chrono::duration<double> unsaved = now - typeface->unsaved_since;
+        if (unsaved.count() >= FONT_GLYPH_CACHE_SAVE_DELAY ||
+            typeface->unsaved_bytes >= FONT_GLYPH_CACHE_UNSAVED_BYTES) {
+            font_glyph_cache_store(typeface.get());
+        }
+    }
+}
+
+// Save the glyphs not saved yet and release FreeType. Call once at exit.
+static void font_free() {
+    for (auto& typeface : font_typefaces) {
+        if (!typeface->unsaved.empty()) font_glyph_cache_store(typeface.get());
+        if (typeface->cache) fclose(typeface->cache);
+        if (typeface->face) FT_Done_Face(typeface->face);
+        glDeleteTextures(1, &typeface->atlas);
+        free(typeface->file.data);
+    }
+    font_typefaces.clear();
+
+    if (ft_lib) FT_Done_FreeType(ft_lib);
+    ft_lib = nullptr;
+}
+
 #endif
@@ -0,0 +1,427 @@
+#pragma once
+#if !defined(GL_INSTRUMENT_H)
+#define GL_INSTRUMENT_H
+
+// Counts the GL calls of every frame when built with make GL_INSTRUMENT=1.
+// The GL entry points the renderer uses are replaced by macros that count the
+// call and the bytes it moves before calling through, so the code calling GL
+// stays the same. gl_state.h includes this, and every header calling GL
+// includes gl_state.h before its code. Without GL_INSTRUMENT this header is
+// empty.
+
+#if defined(GL_INSTRUMENT)
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cstdio>
+
+#include "type.h"
+
+#define GL_INSTRUMENT_HISTORY 600
+
+struct GlInstrumentFrame {
+    int draw_calls;
+    u64 vertices; // Vertices or indices drawn
+    int binds;    // Programs, vertex arrays, buffers, textures and samplers
+    int state_changes;
+    int uniform_uploads;
+    u64 uniform_bytes;
+    int buffer_uploads;
+    u64 buffer_bytes;
+    int texture_uploads;
+    u64 texture_bytes;
+};
+
+struct GlInstrument {
+    GlInstrumentFrame frame; // Counted so far this frame
+    GlInstrumentFrame history[GL_INSTRUMENT_HISTORY];
+    int frame_count; // Frames ended so far
+};
+
+GlInstrument gl_instrument;
+
+// The counts of the frame that ended last
+static GlInstrumentFrame const* gl_instrument_last_frame() {
+    if (!gl_instrument.frame_count) return &gl_instrument.frame;
+    auto index = (gl_instrument.frame_count - 1) % GL_INSTRUMENT_HISTORY;
+    return &gl_instrument.history[index];
+}
+
+static void gl_instrument_end_frame() {
+    auto index = gl_instrument.frame_count++ % GL_INSTRUMENT_HISTORY;
+    gl_instrument.history[index] = gl_instrument.frame;
+    gl_instrument.frame          = {};
+}
+
+// Write the recorded frames, oldest first, as CSV for comparing builds
+static bool gl_instrument_dump(const char* path) {
+    auto file = fopen(path, "w");
+    if (!file) return false;
+
+    fprintf(file, "frame,draw_calls,vertices,binds,state_changes,"
+                  "uniform_uploads,uniform_bytes,buffer_uploads,buffer_bytes,"
+                  "texture_uploads,texture_bytes\n");
+
+    auto count = std::min(gl_instrument.frame_count, GL_INSTRUMENT_HISTORY);
+    for (auto i = gl_instrument.frame_count - count;
+         i < gl_instrument.frame_count; i++) {
+        auto& frame = gl_instrument.history[i % GL_INSTRUMENT_HISTORY];
+        fprintf(file, "%i,%i,%llu,%i,%i,%i,%llu,%i,%llu,%i,%llu\n", i,
+                frame.draw_calls, (unsigned long long)frame.vertices,
+                frame.binds, frame.state_changes, frame.uniform_uploads,
+                (unsigned long long)frame.uniform_bytes, frame.buffer_uploads,
+                (unsigned long long)frame.buffer_bytes, frame.texture_uploads,
+                (unsigned long long)frame.texture_bytes);
+    }
+
+    fclose(file);
+    return true;
+}
+
+// Bytes of uncompressed pixels, as given to glTexImage and glTexSubImage
+static u64 gl_instrument_pixel_bytes(GLenum format, GLenum type, u64 pixels) {
+    u64 components = 4;
+    switch (format) {
+    case GL_RED: components = 1; break;
+    case GL_RG: components = 2; break;
+    case GL_RGB: components = 3; break;
+    }
+
+    u64 size = 1;
+    switch (type) {
+    case GL_UNSIGNED_SHORT:
+    case GL_HALF_FLOAT: size = 2; break;
+    case GL_UNSIGNED_INT:
+    case GL_FLOAT: size = 4; break;
+    }
+
+    return components * size * pixels;
+}
+
+static void gl_instrument_texture(const void* pixels, u64 bytes) {
+    if (!pixels) return; // Only allocates storage
+    gl_instrument.frame.texture_uploads++;
+    gl_instrument.frame.texture_bytes += bytes;
+}
+
+// Draws
+
+static void gl_instrument_draw_elements(GLenum mode, GLsizei count,
+                                        GLenum type, const void* indices) {
+    gl_instrument.frame.draw_calls++;
+    gl_instrument.frame.vertices += count;
+    glDrawElements(mode, count, type, indices);
+}
+
+static void gl_instrument_draw_elements_base_vertex(GLenum mode,
+                                                    GLsizei count, GLenum type,
+                                                    const void* indices,
+                                                    GLint base_vertex) {
+    gl_instrument.frame.draw_calls++;
+    gl_instrument.frame.vertices += count;
+    glDrawElementsBaseVertex(mode, count, type, indices, base_vertex);
+}
+
+static void gl_instrument_draw_arrays(GLenum mode, GLint first,
+                                      GLsizei count) {
+    gl_instrument.frame.draw_calls++;
+    gl_instrument.frame.vertices += count;
+    glDrawArrays(mode, first, count);
+}
+
+static void gl_instrument_multi_draw_arrays(GLenum mode, const GLint* first,
+                                            const GLsizei* count,
+                                            GLsizei draw_count) {
+    gl_instrument.frame.draw_calls++;
+    for (auto i = 0; i < draw_count; i++)
+        gl_instrument.frame.vertices += count[i];
+    glMultiDrawArrays(mode, first, count, draw_count);
+}
+
+// Binds
+
+static void gl_instrument_use_program(GLuint program) {
+    gl_instrument.frame.binds++;
+    glUseProgram(program);
+}
+
+static void gl_instrument_bind_vertex_array(GLuint vertex_array) {
+    gl_instrument.frame.binds++;
+    glBindVertexArray(vertex_array);
+}
+
+static void gl_instrument_bind_buffer(GLenum target, GLuint buffer) {
+    gl_instrument.frame.binds++;
+    glBindBuffer(target, buffer);
+}
+
+static void gl_instrument_bind_buffer_base(GLenum target, GLuint index,
+                                           GLuint buffer) {
+    gl_instrument.frame.binds++;
+    glBindBufferBase(target, index, buffer);
+}
+
+static void gl_instrument_bind_texture(GLenum target, GLuint texture) {
+    gl_instrument.frame.binds++;
+    glBindTexture(target, texture);
+}
+
+static void gl_instrument_active_texture(GLenum unit) {
+    gl_instrument.frame.binds++;
+    glActiveTexture(unit);
+}
+
+static void gl_instrument_bind_sampler(GLuint unit, GLuint sampler) {
+    gl_instrument.frame.binds++;
+    glBindSampler(unit, sampler);
+}
+
+// Fixed function state
+
+static void gl_instrument_enable(GLenum capability) {
+    gl_instrument.frame.state_changes++;
+    glEnable(capability);
+}
+
+static void gl_instrument_disable(GLenum capability) {
+    gl_instrument.frame.state_changes++;
+    glDisable(capability);
+}
+
+static void gl_instrument_blend_func(GLenum source, GLenum destination) {
+    gl_instrument.frame.state_changes++;
+    glBlendFunc(source, destination);
+}
+
+static void gl_instrument_blend_func_separate(GLenum source_rgb,
+                                             GLenum destination_rgb,
+                                             GLenum source_alpha,
+                                             GLenum destination_alpha) {
+    gl_instrument.frame.state_changes++;
+    glBlendFuncSeparate(source_rgb, destination_rgb, source_alpha,
+                        destination_alpha);
+}
+
+static void gl_instrument_blend_equation(GLenum mode) {
+    gl_instrument.frame.state_changes++;
+    glBlendEquation(mode);
+}
+
+static void gl_instrument_blend_equation_separate(GLenum mode_rgb,
+                                                 GLenum mode_alpha) {
+    gl_instrument.frame.state_changes++;
+    glBlendEquationSeparate(mode_rgb, mode_alpha);
+}
+
+static void gl_instrument_scissor(GLint x, GLint y, GLsizei width,
+                                  GLsizei height) {
+    gl_instrument.frame.state_changes++;
+    glScissor(x, y, width, height);
+}
+
+static void gl_instrument_viewport(GLint x, GLint y, GLsizei width,
+                                   GLsizei height) {
+    gl_instrument.frame.state_changes++;
+    glViewport(x, y, width, height);
+}
+
+// Uniforms
+
+static void gl_instrument_uniform(u64 bytes) {
+    gl_instrument.frame.uniform_uploads++;
+    gl_instrument.frame.uniform_bytes += bytes;
+}
+
+static void gl_instrument_uniform_1i(GLint location, GLint value) {
+    gl_instrument_uniform(sizeof(GLint));
+    glUniform1i(location, value);
+}
+
+static void gl_instrument_uniform_4fv(GLint location, GLsizei count,
+                                      const GLfloat* value) {
+    gl_instrument_uniform(4 * sizeof(GLfloat) * count);
+    glUniform4fv(location, count, value);
+}
+
+static void gl_instrument_uniform_matrix_4fv(GLint location, GLsizei count,
+                                             GLboolean transpose,
+                                             const GLfloat* value) {
+    gl_instrument_uniform(16 * sizeof(GLfloat) * count);
+    glUniformMatrix4fv(location, count, transpose, value);
+}
+
+// Buffer uploads
+
+static void gl_instrument_buffer_data(GLenum target, GLsizeiptr size,
+                                      const void* data, GLenum usage) {
+    if (data) {
+        gl_instrument.frame.buffer_uploads++;
+        gl_instrument.frame.buffer_bytes += size;
+    }
+    glBufferData(target, size, data, usage);
+}
+
+static void gl_instrument_buffer_sub_data(GLenum target, GLintptr offset,
+                                          GLsizeiptr size, const void* data) {
+    gl_instrument.frame.buffer_uploads++;
+    gl_instrument.frame.buffer_bytes += size;
+    glBufferSubData(target, offset, size, data);
+}
+
+// Written through the pointer, so counted when mapped
+static void* gl_instrument_map_buffer_range(GLenum target, GLintptr offset,
+                                            GLsizeiptr length,
+                                            GLbitfield access) {
+    if (access & GL_MAP_WRITE_BIT) {
+        gl_instrument.frame.buffer_uploads++;
+        gl_instrument.frame.buffer_bytes += length;
+    }
+    return glMapBufferRange(target, offset, length, access);
+}
+
+// Texture uploads
+
+static void gl_instrument_tex_image_2d(GLenum target, GLint level,
+                                       GLint internal_format, GLsizei width,
+                                       GLsizei height, GLint border,
+                                       GLenum format, GLenum type,
+                                       const void* pixels) {
+    gl_instrument_texture(pixels, gl_instrument_pixel_bytes(
+                                      format, type, (u64)width * height));
+    glTexImage2D(target, level, internal_format, width, height, border,
+                 format, type, pixels);
+}
+
+static void gl_instrument_tex_image_3d(GLenum target, GLint level,
+                                       GLint internal_format, GLsizei width,
+                                       GLsizei height, GLsizei depth,
+                                       GLint border, GLenum format,
+                                       GLenum type, const void* pixels) {
+    gl_instrument_texture(pixels,
+                          gl_instrument_pixel_bytes(
+                              format, type, (u64)width * height * depth));
+    glTexImage3D(target, level, internal_format, width, height, depth, border,
+                 format, type, pixels);
+}
+
+static void gl_instrument_tex_sub_image_2d(GLenum target, GLint level,
+                                           GLint x, GLint y, GLsizei width,
+                                           GLsizei height, GLenum format,
+                                           GLenum type, const void* pixels) {
+    gl_instrument_texture(pixels, gl_instrument_pixel_bytes(
+                                      format, type, (u64)width * height));
+    glTexSubImage2D(target, level, x, y, width, height, format, type, pixels);
+}
+
+static void gl_instrument_tex_sub_image_3d(GLenum target, GLint level,
+                                           GLint x, GLint y, GLint z,
+                                           GLsizei width, GLsizei height,
+                                           GLsizei depth, GLenum format,
+                                           GLenum type, const void* pixels) {
+    gl_instrument_texture(pixels,
+                          gl_instrument_pixel_bytes(
+                              format, type, (u64)width * height * depth));
+    glTexSubImage3D(target, level, x, y, z, width, height, depth, format, type,
+                    pixels);
+}
+
+static void gl_instrument_compressed_tex_image_2d(
+    GLenum target, GLint level, GLenum internal_format, GLsizei width,
+    GLsizei height, GLint border, GLsizei size, const void* data) {
+    gl_instrument_texture(data, size);
+    glCompressedTexImage2D(target, level, internal_format, width, height,
+                           border, size, data);
+}
+
+static void gl_instrument_compressed_tex_image_3d(
+    GLenum target, GLint level, GLenum internal_format, GLsizei width,
+    GLsizei height, GLsizei depth, GLint border, GLsizei size,
+    const void* data) {
+    gl_instrument_texture(data, size);
+    glCompressedTexImage3D(target, level, internal_format, width, height,
+                           depth, border, size, data);
+}
+
+static void gl_instrument_compressed_tex_sub_image_3d(
+    GLenum target, GLint level, GLint x, GLint y, GLint z, GLsizei width,
+    GLsizei height, GLsizei depth, GLenum format, GLsizei size,
+    const void* data) {
+    gl_instrument_texture(data, size);
+    glCompressedTexSubImage3D(target, level, x, y, z, width, height, depth,
+                              format, size, data);
+}
+
+// From here on the entry points go through the functions above. GLEW defines
+// most of them as macros itself.
+
+#undef glDrawElements
+#undef glDrawElementsBaseVertex
+#undef glDrawArrays
+#undef glMultiDrawArrays
+#undef glUseProgram
+#undef glBindVertexArray
+#undef glBindBuffer
+#undef glBindBufferBase
+#undef glBindTexture
+#undef glActiveTexture
+#undef glBindSampler
+#undef glEnable
+#undef glDisable
+#undef glBlendFunc
+#undef glBlendFuncSeparate
+#undef glBlendEquation
+#undef glBlendEquationSeparate
+#undef glScissor
+#undef glViewport
+#undef glUniform1i
+#undef glUniform4fv
+#undef glUniformMatrix4fv
+#undef glBufferData
+#undef glBufferSubData
+#undef glMapBufferRange
+#undef glTexImage2D
+#undef glTexImage3D
+#undef glTexSubImage2D
+#undef glTexSubImage3D
+#undef glCompressedTexImage2D
+#undef glCompressedTexImage3D
+#undef glCompressedTexSubImage3D
+
+#define glDrawElements gl_instrument_draw_elements
+#define glDrawElementsBaseVertex gl_instrument_draw_elements_base_vertex
+#define glDrawArrays gl_instrument_draw_arrays
+#define glMultiDrawArrays gl_instrument_multi_draw_arrays
+#define glUseProgram gl_instrument_use_program
+#define glBindVertexArray gl_instrument_bind_vertex_array
+#define glBindBuffer gl_instrument_bind_buffer
+#define glBindBufferBase gl_instrument_bind_buffer_base
+#define glBindTexture gl_instrument_bind_texture
+#define glActiveTexture gl_instrument_active_texture
+#define glBindSampler gl_instrument_bind_sampler
+#define glEnable gl_instrument_enable
+#define glDisable gl_instrument_disable
+#define glBlendFunc gl_instrument_blend_func
+#define glBlendFuncSeparate gl_instrument_blend_func_separate
+#define glBlendEquation gl_instrument_blend_equation
+#define glBlendEquationSeparate gl_instrument_blend_equation_separate
+#define glScissor gl_instrument_scissor
+#define glViewport gl_instrument_viewport
+#define glUniform1i gl_instrument_uniform_1i
+#define glUniform4fv gl_instrument_uniform_4fv
+#define glUniformMatrix4fv gl_instrument_uniform_matrix_4fv
+#define glBufferData gl_instrument_buffer_data
+#define glBufferSubData gl_instrument_buffer_sub_data
+#define glMapBufferRange gl_instrument_map_buffer_range
+#define glTexImage2D gl_instrument_tex_image_2d
+#define glTexImage3D gl_instrument_tex_image_3d
+#define glTexSubImage2D gl_instrument_tex_sub_image_2d
+#define glTexSubImage3D gl_instrument_tex_sub_image_3d
+#define glCompressedTexImage2D gl_instrument_compressed_tex_image_2d
+#define glCompressedTexImage3D gl_instrument_compressed_tex_image_3d
+#define glCompressedTexSubImage3D gl_instrument_compressed_tex_sub_image_3d
+
+#endif
+
+#endif
@@ -0,0 +1,154 @@
+#pragma once
+#if !defined(GL_STATE_H)
+#define GL_STATE_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "gl_instrument.h"
+#include "type.h"
+
+// A shadow copy of the GL state the game changes, so that setting state that
+// is already current costs nothing. Everything that binds or enables state
+// tracked here has to go through these functions, code that does not, such as
+// the ImGui backend, must restore what it changed.
+
+#define GL_STATE_UNKNOWN 0xffffffffu
+#define GL_STATE_TEXTURE_UNITS 16
+#define GL_STATE_UNIFORM_BINDINGS 8
+
+// Texture targets with a binding of their own on every unit
+enum GlStateTextureTarget {
+    GL_STATE_TEXTURE_2D,
+    GL_STATE_TEXTURE_2D_ARRAY,
+    GL_STATE_TEXTURE_TARGET_COUNT,
+};
+
+enum GlStateCapability {
+    GL_STATE_DEPTH_TEST,
+    GL_STATE_BLEND,
+    GL_STATE_CULL_FACE,
+    GL_STATE_CAPABILITY_COUNT,
+};
+
+struct GlStateStats {
+    int issued;  // Calls that reached GL
+    int skipped; // Calls that matched the current state
+};
+
+struct GlState {
+    u32 program;
+    u32 vertex_array;
+    u32 array_buffer;
+    u32 uniform_buffer;
+    u32 uniform_bindings[GL_STATE_UNIFORM_BINDINGS];
+    u32 active_unit;
+    u32 textures[GL_STATE_TEXTURE_UNITS][GL_STATE_TEXTURE_TARGET_COUNT];
+    u32 capabilities[GL_STATE_CAPABILITY_COUNT];
+
+    GlStateStats frame;      // Counted so far this frame
+    GlStateStats last_frame; // Counted during the previous frame
+};
+
+GlState gl_state;
+
+// Returns whether the call has to be issued and counts it
+static bool gl_state_change(u32* current, u32 value) {
+    if (*current == value) {
+        gl_state.frame.skipped++;
+        return false;
+    }
+
+    *current = value;
+    gl_state.frame.issued++;
+    return true;
+}
+
+static void gl_state_use_program(u32 program) {
+    if (gl_state_change(&gl_state.program, program)) glUseProgram(program);
+}
+
+// Delete a program, which may be the current one
+static void gl_state_delete_program(u32 program) {
+    if (gl_state.program == program) gl_state.program = GL_STATE_UNKNOWN;
+    glDeleteProgram(program);
+}
+
+static void gl_state_bind_vertex_array(u32 vertex_array) {
+    if (gl_state_change(&gl_state.vertex_array, vertex_array))
+        glBindVertexArray(vertex_array);
+}
+
+static void gl_state_bind_buffer(u32 target, u32 buffer) {
+    u32* current = nullptr;
+    switch (target) {
+    case GL_ARRAY_BUFFER: current = &gl_state.array_buffer; break;
+    case GL_UNIFORM_BUFFER: current = &gl_state.uniform_buffer; break;
+    }
+
+    if (!current) {
+        // Element array buffers belong to the vertex array, so they are not
+        // tracked
+        gl_state.frame.issued++;
+        glBindBuffer(target, buffer);
+    } else if (gl_state_change(current, buffer)) {
+        glBindBuffer(target, buffer);
+    }
+}
+
+// Bind a uniform buffer to a binding point. Like GL this also makes it the
+// bound GL_UNIFORM_BUFFER.
+static void gl_state_bind_uniform_base(u32 binding, u32 buffer) {
+    if (!gl_state_change(&gl_state.uniform_bindings[binding], buffer)) return;
+
+    gl_state.uniform_buffer = buffer;
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+}
+
+static void gl_state_bind_texture(u32 unit, u32 target, u32 texture) {
+    u32* current = nullptr;
+    switch (target) {
+    case GL_TEXTURE_2D:
+        current = &gl_state.textures[unit][GL_STATE_TEXTURE_2D];
+        break;
+    case GL_TEXTURE_2D_ARRAY:
+        current = &gl_state.textures[unit][GL_STATE_TEXTURE_2D_ARRAY];
+        break;
+    }
+
+    if (!current) {
+        gl_state.frame.issued++;
+    } else if (!gl_state_change(current, texture)) {
+        return;
+    }
+
+    if (gl_state_change(&gl_state.active_unit, unit))
+        glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(target, texture);
+}
+
+static void gl_state_enable(u32 capability, bool enabled) {
+    auto index = GL_STATE_CAPABILITY_COUNT;
+    switch (capability) {
+    case GL_DEPTH_TEST: index = GL_STATE_DEPTH_TEST; break;
+    case GL_BLEND: index = GL_STATE_BLEND; break;
+    case GL_CULL_FACE: index = GL_STATE_CULL_FACE; break;
+    }
+
+    if (index == GL_STATE_CAPABILITY_COUNT ||
+        gl_state_change(&gl_state.capabilities[index], enabled)) {
+        if (enabled) {
+            glEnable(capability);
+        } else {
+            glDisable(capability);
+        }
+    }
+}
+
+// Keep the counts of the frame that ended and start counting the next
+static void gl_state_end_frame() {
+    gl_state.last_frame = gl_state.frame;
+    gl_state.frame      = {};
+}
+
+#endif
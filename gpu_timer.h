@@ -0,0 +1,55 @@
+#pragma once
+#if !defined(GPU_TIMER_H)
+#define GPU_TIMER_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "type.h"
+
+// Measures the GPU time of a range of commands with GL_TIME_ELAPSED queries.
+// Every frame uses the next query of a ring, and a result is only read once
+// the driver reports it available, so timing never stalls the pipeline.
+
+#define GPU_TIMER_QUERIES 3
+
+struct GpuTimer {
+    u32 queries[GPU_TIMER_QUERIES];
+    bool pending[GPU_TIMER_QUERIES];
+    int current;
+
+    double time; // Seconds taken by the last range with a result
+    int results; // Ranges with a result so far
+};
+
+static void gpu_timer_create(GpuTimer* timer) {
+    *timer = {};
+    glGenQueries(GPU_TIMER_QUERIES, timer->queries);
+}
+
+static void gpu_timer_begin(GpuTimer* timer) {
+    glBeginQuery(GL_TIME_ELAPSED, timer->queries[timer->current]);
+}
+
+static void gpu_timer_end(GpuTimer* timer) {
+    glEndQuery(GL_TIME_ELAPSED);
+    timer->pending[timer->current] = true;
+    timer->current = (timer->current + 1) % GPU_TIMER_QUERIES;
+
+    // The query reused next frame is the oldest one
+    auto query = timer->current;
+    if (!timer->pending[query]) return;
+
+    GLint available;
+    glGetQueryObjectiv(timer->queries[query], GL_QUERY_RESULT_AVAILABLE,
+                       &available);
+    if (!available) return;
+
+    GLuint64 elapsed;
+    glGetQueryObjectui64v(timer->queries[query], GL_QUERY_RESULT, &elapsed);
+    timer->pending[query] = false;
+    timer->time           = elapsed * 1e-9;
+    timer->results++;
+}
+
+#endif
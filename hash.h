@@ -0,0 +1,21 @@
+#pragma once
+#if !defined(HASH_H)
+#define HASH_H
+
+#include "type.h"
+
+#define HASH_FNV1A_BASIS 0xcbf29ce484222325ull
+
+// 64-bit FNV-1a. Pass the previous hash to continue hashing over several
+// pieces of data.
+static u64 hash_fnv1a(const void* data, u64 length,
+                      u64 hash = HASH_FNV1A_BASIS) {
+    auto bytes = (const u8*)data;
+    for (u64 i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#pragma once
+#if !defined(HUD_H)
+#define HUD_H
+
+#include "error.h"
+#include "font.h"
+#include "gl_state.h"
+#include "shader.h"
+
+// Text that changes a few times a second at most, such as the HUD and the
+// menus, is drawn into a texture of its own, and only when a hash of what it
+// shows changes. Every frame then composites that texture over the scene with
+// one triangle covering the screen.
+
+struct HudLayer {
+    unsigned int framebuffer;
+    unsigned int texture;      // Color premultiplied by alpha
+    unsigned int vertex_array; // Empty, the triangle comes from gl_VertexID
+    int width, height;
+    u64 hash;   // Of what the texture shows
+    bool drawn; // Whether the texture shows anything yet
+
+    int frames;  // Frames composited
+    int redraws; // Frames the texture was drawn again
+};
+
+Shader hud_shader;
+ShaderUniform<int> hud_layer_texture;
+
+// Call again whenever hud_shader has been rebuilt
+static void hud_resolve_uniforms() {
+    hud_layer_texture = shaderUniform<int>(hud_shader, "layer");
+}
+
+static void hud_init(HudLayer* layer) {
+    // Finished along with the other startup programs
+    shaderCompileStart(hud_shader, "shaders/hud.vert", "shaders/hud.frag");
+
+    *layer = {};
+    glGenFramebuffers(1, &layer->framebuffer);
+    glGenTextures(1, &layer->texture);
+    glGenVertexArrays(1, &layer->vertex_array);
+}
+
+// Whether the layer has to be drawn again, for a framebuffer of width by
+// height and contents that hash to hash. If so the layer is bound and cleared
+// for drawing, and hud_end has to be called once it is drawn. A minimized
+// window has no pixels to draw to, the layer is left as it is until it has.
+static bool hud_begin(HudLayer* layer, u64 hash, int width, int height) {
+    if (width <= 0 || height <= 0) return false;
+    layer->frames++;
+
+    if (width != layer->width || height != layer->height) {
+        layer->width  = width;
+        layer->height = height;
+        layer->drawn  = false;
+
+        gl_state_bind_texture(0, GL_TEXTURE_2D, layer->texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, layer->framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, layer->texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+            GL_FRAMEBUFFER_COMPLETE) {
+            error("HUD framebuffer incomplete!\n");
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    if (layer->drawn && layer->hash == hash) return false;
+
+    layer->hash  = hash;
+    layer->drawn = true;
+    layer->redraws++;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, layer->framebuffer);
+    glViewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Premultiply the color, so that compositing the layer blends it like
+    // drawing straight to the screen would
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE,
+                        GL_ONE_MINUS_SRC_ALPHA);
+    return true;
+}
+
+static void hud_end(HudLayer* layer) {
+    font_flush();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, layer->width, layer->height);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+// Draw the layer over everything drawn so far
+static void hud_composite(HudLayer* layer) {
+    if (layer->width <= 0 || layer->height <= 0) return;
+
+    shaderBind(hud_shader);
+    shaderSet(hud_layer_texture, 0);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, layer->texture);
+    gl_state_bind_vertex_array(layer->vertex_array);
+
+    // The scene is drawn with depth testing, the layer goes over all of it
+    gl_state_enable(GL_DEPTH_TEST, false);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    gl_state_enable(GL_DEPTH_TEST, true);
+}
+
+#endif
@@ -2,8 +2,19 @@
 #if !defined(IMGUI_OPENGL3_H)
 #define IMGUI_OPENGL3_H
 
+// (Optional) Program cache the backend builds its program through. load
+// returns a linked program for the sources or 0, hint is called on a new
+// program before it is linked and store once it linked successfully.
+struct ImGui_ImplOpenGL3_ProgramCache {
+    unsigned int (*load)(const char* const* sources, int count);
+    void (*hint)(unsigned int program);
+    void (*store)(unsigned int program, const char* const* sources, int count);
+};
+
 // Backend API
-IMGUI_IMPL_API bool ImGui_ImplOpenGL3_Init(const char* glsl_version = NULL);
+IMGUI_IMPL_API bool ImGui_ImplOpenGL3_Init(
+    const char* glsl_version                            = NULL,
+    ImGui_ImplOpenGL3_ProgramCache const* program_cache = NULL);
 IMGUI_IMPL_API void ImGui_ImplOpenGL3_Shutdown();
 IMGUI_IMPL_API void ImGui_ImplOpenGL3_NewFrame();
 IMGUI_IMPL_API void ImGui_ImplOpenGL3_RenderDrawData(ImDrawData* draw_data);
@@ -139,7 +150,9 @@ IMGUI_IMPL_API void ImGui_ImplOpenGL3_DestroyDeviceObjects();
 #define _CRT_SECURE_NO_WARNINGS
 #endif
 
+#include <chrono>
 #include <stdio.h>
+#include <string.h>
 #if defined(_MSC_VER) && _MSC_VER <= 1500 // MSVC 2008 or earlier
 #include <stddef.h>                       // intptr_t
 #else
@@ -228,9 +241,30 @@ static int g_AttribLocationTex     = 0,
 static int g_AttribLocationVtxPos = 0, g_AttribLocationVtxUV = 0,
            g_AttribLocationVtxColor = 0; // Vertex attributes location
 static unsigned int g_VboHandle = 0, g_ElementsHandle = 0;
+static ImGui_ImplOpenGL3_ProgramCache g_ProgramCache = {};
+
+// The command lists of a frame are written one after the other into stream
+// buffers with room for this many frames at the largest size seen so far
+#define IMGUI_IMPL_OPENGL_STREAM_FRAMES 3
+
+struct ImGui_ImplOpenGL3_StreamBuffer {
+    GLsizeiptr high_water; // Most elements a frame has used
+    GLsizeiptr capacity;   // Elements the buffer has room for
+    GLsizeiptr head;       // Next element to write
+};
+
+static ImGui_ImplOpenGL3_StreamBuffer g_VtxStream, g_IdxStream;
+static bool g_StreamBuffers = true; // Otherwise every list is uploaded alone
+static int g_StreamReallocations = 0, g_StreamOrphans = 0;
+static int g_StreamFallbacks = 0; // Uploads that could not use a mapping
+static double g_RenderTime = 0.0; // CPU seconds of the last RenderDrawData
 
 // Functions
-bool ImGui_ImplOpenGL3_Init(const char* glsl_version) {
+bool ImGui_ImplOpenGL3_Init(
+    const char* glsl_version,
+    ImGui_ImplOpenGL3_ProgramCache const* program_cache) {
+    if (program_cache) g_ProgramCache = *program_cache;
+
     // Query for GL version
 #if !defined(IMGUI_IMPL_OPENGL_ES2)
     GLint major, minor;
@@ -372,6 +406,89 @@ static void ImGui_ImplOpenGL3_SetupRenderState(ImDrawData* draw_data,
                           (GLvoid*)IM_OFFSETOF(ImDrawVert, col));
 }
 
+// Reserve count elements of size bytes in the stream buffer bound to target
+// and map them for writing. Returns the first element reserved, *data is NULL
+// if mapping failed. Writes go past everything earlier frames used and the
+// buffer is orphaned when it wraps, so mapping never waits for draws still in
+// flight.
+static GLsizeiptr
+ImGui_ImplOpenGL3_StreamMap(ImGui_ImplOpenGL3_StreamBuffer* stream,
+                            GLenum target, GLsizeiptr size, GLsizeiptr count,
+                            void** data) {
+    if (count > stream->high_water) stream->high_water = count;
+
+    // Storage is only allocated again when a frame outgrows the high-water
+    // mark, otherwise the same size is orphaned
+    auto capacity = IMGUI_IMPL_OPENGL_STREAM_FRAMES * stream->high_water;
+    if (stream->capacity < capacity) {
+        stream->capacity = capacity;
+        stream->head     = 0;
+        glBufferData(target, stream->capacity * size, NULL, GL_STREAM_DRAW);
+        g_StreamReallocations++;
+    } else if (stream->head + count > stream->capacity) {
+        stream->head = 0;
+        glBufferData(target, stream->capacity * size, NULL, GL_STREAM_DRAW);
+        g_StreamOrphans++;
+    }
+
+    auto first        = stream->head;
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                        GL_MAP_UNSYNCHRONIZED_BIT;
+    *data = glMapBufferRange(target, first * size, count * size, access);
+    stream->head += count;
+    return first;
+}
+
+// Write the vertices or indices of every command list, one list after the
+// other, to the mapped range, or with glBufferSubData from offset bytes into
+// the buffer bound to target when nothing is mapped
+static void ImGui_ImplOpenGL3_StreamWrite(ImDrawData* draw_data, GLenum target,
+                                          GLintptr offset, void* mapped) {
+    auto dst = (char*)mapped;
+    for (int n = 0; n < draw_data->CmdListsCount; n++) {
+        const ImDrawList* cmd_list = draw_data->CmdLists[n];
+        const void* src;
+        GLsizeiptr bytes;
+        if (target == GL_ARRAY_BUFFER) {
+            src   = cmd_list->VtxBuffer.Data;
+            bytes = cmd_list->VtxBuffer.Size * sizeof(ImDrawVert);
+        } else {
+            src   = cmd_list->IdxBuffer.Data;
+            bytes = cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx);
+        }
+
+        if (dst) {
+            memcpy(dst, src, bytes);
+            dst += bytes;
+        } else {
+            glBufferSubData(target, offset, bytes, src);
+            offset += bytes;
+        }
+    }
+}
+
+// Write the command lists into the stream buffer bound to target. A range
+// that cannot be mapped, or whose contents are lost by the time it is
+// unmapped, is written with glBufferSubData instead. Returns the first
+// element written.
+static GLsizeiptr
+ImGui_ImplOpenGL3_StreamUpload(ImDrawData* draw_data,
+                               ImGui_ImplOpenGL3_StreamBuffer* stream,
+                               GLenum target, GLsizeiptr size,
+                               GLsizeiptr count) {
+    void* data;
+    auto first = ImGui_ImplOpenGL3_StreamMap(stream, target, size, count,
+                                             &data);
+    if (data) {
+        ImGui_ImplOpenGL3_StreamWrite(draw_data, target, 0, data);
+        if (glUnmapBuffer(target)) return first;
+    }
+
+    g_StreamFallbacks++;
+    ImGui_ImplOpenGL3_StreamWrite(draw_data, target, first * size, NULL);
+    return first;
+}
+
 // OpenGL3 Render function.
 // (this used to be set in io.RenderDrawListsFn and called by ImGui::Render(),
 // but you can now call this directly from your main loop) Note that this
@@ -387,6 +504,8 @@ void ImGui_ImplOpenGL3_RenderDrawData(ImDrawData* draw_data) {
         (int)(draw_data->DisplaySize.y * draw_data->FramebufferScale.y);
     if (fb_width <= 0 || fb_height <= 0) return;
 
+    auto start = std::chrono::steady_clock::now();
+
     // Backup GL state
     GLenum last_active_texture;
     glGetIntegerv(GL_ACTIVE_TEXTURE, (GLint*)&last_active_texture);
@@ -457,17 +576,42 @@ void ImGui_ImplOpenGL3_RenderDrawData(ImDrawData* draw_data) {
         draw_data->FramebufferScale; // (1,1) unless using retina display which
                                      // are often (2,2)
 
+    // Upload all command lists at once when they can be drawn from an offset
+    // with glDrawElementsBaseVertex
+    GLsizeiptr vtx_first = 0, idx_first = 0;
+    bool stream = g_StreamBuffers && draw_data->TotalVtxCount > 0 &&
+                  draw_data->TotalIdxCount > 0;
+#if IMGUI_IMPL_OPENGL_MAY_HAVE_VTX_OFFSET
+    stream = stream && g_GlVersion >= 3200;
+#else
+    stream = false;
+#endif
+    if (stream) {
+        vtx_first = ImGui_ImplOpenGL3_StreamUpload(
+            draw_data, &g_VtxStream, GL_ARRAY_BUFFER, sizeof(ImDrawVert),
+            draw_data->TotalVtxCount);
+        idx_first = ImGui_ImplOpenGL3_StreamUpload(
+            draw_data, &g_IdxStream, GL_ELEMENT_ARRAY_BUFFER,
+            sizeof(ImDrawIdx), draw_data->TotalIdxCount);
+    }
+
     // Render command lists
     for (int n = 0; n < draw_data->CmdListsCount; n++) {
         const ImDrawList* cmd_list = draw_data->CmdLists[n];
 
         // Upload vertex/index buffers
-        glBufferData(GL_ARRAY_BUFFER,
-                     (GLsizeiptr)cmd_list->VtxBuffer.Size * sizeof(ImDrawVert),
-                     (const GLvoid*)cmd_list->VtxBuffer.Data, GL_STREAM_DRAW);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                     (GLsizeiptr)cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx),
-                     (const GLvoid*)cmd_list->IdxBuffer.Data, GL_STREAM_DRAW);
+        if (!stream) {
+            glBufferData(GL_ARRAY_BUFFER,
+                         (GLsizeiptr)cmd_list->VtxBuffer.Size *
+                             sizeof(ImDrawVert),
+                         (const GLvoid*)cmd_list->VtxBuffer.Data,
+                         GL_STREAM_DRAW);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                         (GLsizeiptr)cmd_list->IdxBuffer.Size *
+                             sizeof(ImDrawIdx),
+                         (const GLvoid*)cmd_list->IdxBuffer.Data,
+                         GL_STREAM_DRAW);
+        }
 
         for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; cmd_i++) {
             const ImDrawCmd* pcmd = &cmd_list->CmdBuffer[cmd_i];
@@ -513,9 +657,9 @@ void ImGui_ImplOpenGL3_RenderDrawData(ImDrawData* draw_data) {
                             GL_TRIANGLES, (GLsizei)pcmd->ElemCount,
                             sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT
                                                    : GL_UNSIGNED_INT,
-                            (void*)(intptr_t)(pcmd->IdxOffset *
+                            (void*)(intptr_t)((idx_first + pcmd->IdxOffset) *
                                               sizeof(ImDrawIdx)),
-                            (GLint)pcmd->VtxOffset);
+                            (GLint)(vtx_first + pcmd->VtxOffset));
                     else
 #endif
                         glDrawElements(GL_TRIANGLES, (GLsizei)pcmd->ElemCount,
@@ -527,6 +671,11 @@ void ImGui_ImplOpenGL3_RenderDrawData(ImDrawData* draw_data) {
                 }
             }
         }
+
+        if (stream) {
+            vtx_first += cmd_list->VtxBuffer.Size;
+            idx_first += cmd_list->IdxBuffer.Size;
+        }
     }
 
     // Destroy the temporary VAO
@@ -571,6 +720,10 @@ void ImGui_ImplOpenGL3_RenderDrawData(ImDrawData* draw_data) {
                (GLsizei)last_viewport[3]);
     glScissor(last_scissor_box[0], last_scissor_box[1],
               (GLsizei)last_scissor_box[2], (GLsizei)last_scissor_box[3]);
+
+    g_RenderTime = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
 }
 
 bool ImGui_ImplOpenGL3_CreateFontsTexture() {
@@ -789,26 +942,36 @@ bool ImGui_ImplOpenGL3_CreateDeviceObjects() {
         fragment_shader = fragment_shader_glsl_130;
     }
 
-    // Create shaders
-    const GLchar* vertex_shader_with_version[2] = {g_GlslVersionString,
-                                                   vertex_shader};
-    g_VertHandle = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(g_VertHandle, 2, vertex_shader_with_version, NULL);
-    glCompileShader(g_VertHandle);
-    CheckShader(g_VertHandle, "vertex shader");
-
-    const GLchar* fragment_shader_with_version[2] = {g_GlslVersionString,
-                                                     fragment_shader};
-    g_FragHandle = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(g_FragHandle, 2, fragment_shader_with_version, NULL);
-    glCompileShader(g_FragHandle);
-    CheckShader(g_FragHandle, "fragment shader");
-
-    g_ShaderHandle = glCreateProgram();
-    glAttachShader(g_ShaderHandle, g_VertHandle);
-    glAttachShader(g_ShaderHandle, g_FragHandle);
-    glLinkProgram(g_ShaderHandle);
-    CheckProgram(g_ShaderHandle, "shader program");
+    // Create shaders, or load the linked program from the program cache
+    const char* sources[] = {g_GlslVersionString, vertex_shader,
+                             g_GlslVersionString, fragment_shader};
+    g_ShaderHandle = 0;
+    if (g_ProgramCache.load) g_ShaderHandle = g_ProgramCache.load(sources, 4);
+    if (!g_ShaderHandle) {
+        const GLchar* vertex_shader_with_version[2] = {g_GlslVersionString,
+                                                       vertex_shader};
+        g_VertHandle = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(g_VertHandle, 2, vertex_shader_with_version, NULL);
+        glCompileShader(g_VertHandle);
+        CheckShader(g_VertHandle, "vertex shader");
+
+        const GLchar* fragment_shader_with_version[2] = {g_GlslVersionString,
+                                                         fragment_shader};
+        g_FragHandle = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(g_FragHandle, 2, fragment_shader_with_version, NULL);
+        glCompileShader(g_FragHandle);
+        CheckShader(g_FragHandle, "fragment shader");
+
+        g_ShaderHandle = glCreateProgram();
+        glAttachShader(g_ShaderHandle, g_VertHandle);
+        glAttachShader(g_ShaderHandle, g_FragHandle);
+        if (g_ProgramCache.hint) g_ProgramCache.hint(g_ShaderHandle);
+        glLinkProgram(g_ShaderHandle);
+        if (CheckProgram(g_ShaderHandle, "shader program") &&
+            g_ProgramCache.store) {
+            g_ProgramCache.store(g_ShaderHandle, sources, 4);
+        }
+    }
 
     g_AttribLocationTex      = glGetUniformLocation(g_ShaderHandle, "Texture");
     g_AttribLocationProjMtx  = glGetUniformLocation(g_ShaderHandle, "ProjMtx");
@@ -841,6 +1004,8 @@ void ImGui_ImplOpenGL3_DestroyDeviceObjects() {
         glDeleteBuffers(1, &g_ElementsHandle);
         g_ElementsHandle = 0;
     }
+    g_VtxStream = {};
+    g_IdxStream = {};
     if (g_ShaderHandle && g_VertHandle) {
         glDetachShader(g_ShaderHandle, g_VertHandle);
     }
@@ -6,22 +6,32 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <ctime>
 #include <random>
 #include <vector>
 
 #include "camera.h"
 #include "collectible.h"
 #include "font.h"
+#include "gpu_timer.h"
+#include "hud.h"
 #include "imgui/imgui.h"
 #include "imgui_glfw.h"
 #include "imgui_opengl3.h"
 #include "model.h"
 #include "obstacle.h"
+#include "physics.h"
 #include "player.h"
+#include "scene_cache.h"
 #include "shader.h"
+#include "std140.h"
 #include "string.h"
 #include "terrain.h"
 #include "texture.h"
+#include "texture_atlas.h"
+#include "texture_stream.h"
+#include "thread_pool.h"
+#include "uniform_buffer.h"
 #include "wall.h"
 
 #define DEMO 1
@@ -40,24 +50,89 @@ struct Mouse {
     bool firstMouse{true};
 };
 
+// Share of one core the process keeps busy, measured over about a second
+struct CpuMeter {
+    double wallStart{0.0};
+    std::clock_t cpuStart{0};
+    float utilization{0.0f};
+};
+
+// GPU time of the terrain pass, summed separately with variants per draw
+// ([1]) and with the general variant only ([0])
+struct TerrainPassTimes {
+    double time[2]{};
+    int frames[2]{};
+    int results{0}; // Results of the timer counted so far
+    int skip{0};    // Results still from before the last toggle
+    bool variants{true};
+};
+
+// The lights are uploaded to the Lights block as they are, so they follow
+// std140: every vec3 starts on 16 bytes and a float may follow in its last
+// four. The shaders get their declarations from the descriptions below.
 struct DirectionalLight {
-    glm::vec3 direction;
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
+    alignas(16) glm::vec3 direction;
+    alignas(16) glm::vec3 ambient;
+    alignas(16) glm::vec3 diffuse;
+    alignas(16) glm::vec3 specular;
 };
 
+template <>
+struct Std140Struct<DirectionalLight> {
+    static constexpr const char* name    = "DirectionalLight";
+    static constexpr Std140Field fields[] = {
+        STD140_FIELD(DirectionalLight, direction),
+        STD140_FIELD(DirectionalLight, ambient),
+        STD140_FIELD(DirectionalLight, diffuse),
+        STD140_FIELD(DirectionalLight, specular),
+    };
+};
+static_assert(std140_check<DirectionalLight>(), "std140 DirectionalLight");
+
 struct PointLight {
-    glm::vec3 position;
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
+    alignas(16) glm::vec3 position;
+    alignas(16) glm::vec3 ambient;
+    alignas(16) glm::vec3 diffuse;
+    alignas(16) glm::vec3 specular;
 
     float constant;
     float linear;
     float quadratic;
 };
 
+template <>
+struct Std140Struct<PointLight> {
+    static constexpr const char* name    = "PointLight";
+    static constexpr Std140Field fields[] = {
+        STD140_FIELD(PointLight, position),
+        STD140_FIELD(PointLight, ambient),
+        STD140_FIELD(PointLight, diffuse),
+        STD140_FIELD(PointLight, specular),
+        STD140_FIELD(PointLight, constant),
+        STD140_FIELD(PointLight, linear),
+        STD140_FIELD(PointLight, quadratic),
+    };
+};
+static_assert(std140_check<PointLight>(), "std140 PointLight");
+
+// Contents of the Material block, read by the lit shaders as material
+struct MaterialBlock {
+    alignas(16) glm::vec3 diffuse;
+    alignas(16) glm::vec3 specular;
+    float shininess;
+};
+
+template <>
+struct Std140Struct<MaterialBlock> {
+    static constexpr const char* name    = "Material";
+    static constexpr Std140Field fields[] = {
+        STD140_FIELD(MaterialBlock, diffuse),
+        STD140_FIELD(MaterialBlock, specular),
+        STD140_FIELD(MaterialBlock, shininess),
+    };
+};
+static_assert(std140_check<MaterialBlock>(), "std140 Material");
+
 struct Models {
     Model bunnyModel;
     Model sphereModel;
@@ -77,35 +152,145 @@ glm::vec3 terrainScale{0.2f, 1.0f, 0.2f};
 
 GLFWwindow* window;
 Frame frame;
+CpuMeter cpuMeter;
 Shader shader;
 Player player;
 Camera camera;
 Mouse mouse;
 Terrain terrain;
-Shader materialShader;
-Shader terrainMaterialShader;
+ShaderVariants materialShaders;
+ShaderVariants terrainShaders;
 Shader skyboxShader;
 Models models;
 std::vector<Collectible> collectibles;
-std::vector<Obstacle> obstacles;
+PhysicsWorld physics;
 std::vector<Wall> walls(4);
 DirectionalLight dir_light;
 
 #define POINT_LIGHT_COUNT 8
 PointLight point_lights[POINT_LIGHT_COUNT];
 
-Texture terrain_splatmap;
-Texture terrain_textures[4];
-Texture furTexture;
-Texture collectibleTexture;
-Texture rockTexture;
-Texture lightRockTexture;
+// std140 contents of the per-frame uniform blocks
+struct CameraBlock {
+    glm::mat4 projection;
+    glm::mat4 view;
+    alignas(16) glm::vec3 view_position;
+};
+
+template <>
+struct Std140Struct<CameraBlock> {
+    static constexpr const char* name    = "Camera";
+    static constexpr Std140Field fields[] = {
+        STD140_FIELD(CameraBlock, projection),
+        STD140_FIELD(CameraBlock, view),
+        STD140_FIELD(CameraBlock, view_position),
+    };
+};
+static_assert(std140_check<CameraBlock>(), "std140 Camera");
+
+struct LightsBlock {
+    DirectionalLight dir_light;
+    PointLight point_light[POINT_LIGHT_COUNT];
+};
+
+template <>
+struct Std140Struct<LightsBlock> {
+    static constexpr const char* name    = "Lights";
+    static constexpr Std140Field fields[] = {
+        STD140_FIELD(LightsBlock, dir_light),
+        STD140_FIELD(LightsBlock, point_light),
+    };
+};
+static_assert(std140_check<LightsBlock>(), "std140 Lights");
+
+glm::mat4 projectionMatrix;
+UniformBuffer cameraBuffer;
+UniformBuffer lightsBuffer;
+
+// The materials never change, each is written to its own buffer once and
+// bound to UNIFORM_BINDING_MATERIAL before drawing with it
+UniformBuffer entityMaterialBuffer;
+UniformBuffer terrainMaterialBuffer;
+
+struct MaterialUniforms {
+    u32 generation; // Of the variant the handles were resolved for
+    ShaderUniform<glm::mat4> model;
+    ShaderUniform<int> tex;
+    ShaderUniform<glm::vec4> atlas_rect;
+};
+
+struct TerrainUniforms {
+    u32 generation;
+    ShaderUniform<glm::mat4> model;
+    ShaderUniform<int> splatmaps;
+    ShaderUniform<int> layers;
+};
+
+struct SkyboxUniforms {
+    ShaderUniform<glm::mat4> model;
+    ShaderUniform<int> tex;
+};
+
+// Every shader variant has its own uniform locations
+std::unordered_map<const Shader*, MaterialUniforms> materialUniforms;
+std::unordered_map<const Shader*, TerrainUniforms> terrainUniforms;
+SkyboxUniforms skyboxUniforms;
+
+// The lit shaders are built for the point lights in use and the features of
+// the material drawn, so that the fragment shaders skip work that would add
+// nothing. Turned off, every draw uses the most general variant.
+bool shaderPermutations{true};
+GpuTimer terrainTimer;
+TerrainPassTimes terrainPassTimes;
+
+// CPU time spent writing the per-frame camera and light blocks
+double uniformTime;
+
+// Shaders are rebuilt on F5, or when their sources change on disk
+#define SHADER_WATCH_INTERVAL 0.5
+double shaderWatchTime;
+bool shaderReloadRequested{false};
+
+// Wall-clock time from submitting the startup programs until all of them were
+// built, and the part of it init spent waiting once everything else was loaded
+double shaderStartupTime;
+double shaderStartupWait;
+
+// Set by starting the game with --stats, which prints timings to stdout
+bool printStats{false};
+
+// Layer i of the terrain is weighted by channel i % 4 of splatmap layer i / 4,
+// the last layer takes whatever weight is left.
+Texture terrain_splatmaps;
+Texture terrain_layers;
 Texture skyboxTexture;
 
+// All entity materials share one atlas, so the entities are drawn with a
+// single texture bind.
+TextureAtlas entityAtlas;
+enum EntityMaterial {
+    ENTITY_MATERIAL_FUR,
+    ENTITY_MATERIAL_GOLD,
+    ENTITY_MATERIAL_ROCK,
+    ENTITY_MATERIAL_LIGHT_ROCK,
+};
+int entityBindsSaved;
+
 Model skybox;
 
+ThreadPool threadPool;
+TextureStreamer textureStreamer;
+
 Font menuFont;
 Font interfaceFont;
+HudLayer hudLayer;
+SceneCache sceneCache;
+
+// While a menu is open the game waits for input instead of drawing frames as
+// fast as it can, but wakes up this often, in seconds, to keep texture
+// streaming and shader builds moving
+#define IDLE_TICK 0.1
+bool idleInMenus{true};
 
 bool inMainMenu;
 bool inMenu{false};
@@ -122,6 +307,8 @@ void continueGame() {
 
 void framebufferSizeCallback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
+    // Texture detail is picked by how many pixels a texel covers
+    texture_stream_set_view(&textureStreamer, glm::radians(45.0f), height);
 }
 
 void mouseCallback(GLFWwindow* window, double xPos, double yPos) {
@@ -155,6 +342,13 @@ void keyCallback(GLFWwindow* window, int key, int scanCode, int action,
         }
     }
 
+    if (key == GLFW_KEY_F5 && action == GLFW_PRESS) {
+        shaderReloadRequested = true;
+    }
+    if (printStats && key == GLFW_KEY_F6 && action == GLFW_PRESS) {
+        shaderPermutations = !shaderPermutations;
+    }
+
 #ifndef DEMO
     // toggle cursor
     if (key == GLFW_KEY_F && action == GLFW_PRESS) {
@@ -255,14 +449,14 @@ void spawnObstacles() {
     std::uniform_real_distribution<float> uniformDistX(2, terrWidth - 2);
     std::uniform_real_distribution<float> uniformDistZ(2, terrHeight - 2);
 
-    for (int i = obstacles.size(); i < waveNr * obstacleFactor; i++) {
+    for (int i = physics.obstacles.size(); i < waveNr * obstacleFactor; i++) {
         float x = uniformDistX(e1);
         float z = uniformDistZ(e1);
         TerrainPosition pos;
         terrainGetPosition(&terrain, x, z, &pos);
 
         Obstacle obstacle{pos.position, pos.normal, models.sphereModel.radius};
-        obstacles.push_back(obstacle);
+        physics.obstacles.push_back(obstacle);
     }
 }
 
@@ -310,7 +504,7 @@ void restartGame() {
     inMainMenu       = false;
     mouse.firstMouse = true;
     waveNr           = 1;
-    obstacles.clear();
+    physics.obstacles.clear();
     collectibles.clear();
     spawnPlayer();
     spawnObstacles();
@@ -318,25 +512,278 @@ void restartGame() {
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 }
 
-bool button_draw(Font* font, float x, float y, const char* msg) {
-    auto width  = font_width(font, msg);
-    auto inside = false;
-    auto click  = false;
+// The handles of a material variant, resolved again after it was rebuilt
+MaterialUniforms* getMaterialUniforms(Shader& variant) {
+    auto& uniforms = materialUniforms[&variant];
+    if (uniforms.generation != variant.generation) {
+        uniforms.model      = shaderUniform<glm::mat4>(variant, "model");
+        uniforms.tex        = shaderUniform<int>(variant, "tex");
+        uniforms.atlas_rect = shaderUniform<glm::vec4>(variant, "atlas_rect");
+        uniforms.generation = variant.generation;
+    }
+    return &uniforms;
+}
+
+TerrainUniforms* getTerrainUniforms(Shader& variant) {
+    auto& uniforms = terrainUniforms[&variant];
+    if (uniforms.generation != variant.generation) {
+        uniforms.model      = shaderUniform<glm::mat4>(variant, "model");
+        uniforms.splatmaps  = shaderUniform<int>(variant, "splatmaps");
+        uniforms.layers     = shaderUniform<int>(variant, "layers");
+        uniforms.generation = variant.generation;
+    }
+    return &uniforms;
+}
+
+// A variant of a lit shader, and the general variant that is drawn with in
+// its place until it has built
+struct LitVariant {
+    Shader* shader;
+    Shader* general;
+};
+
+// The material variant for the point lights in use and whether the material
+// has a specular term
+LitVariant materialVariant(int lightCount, bool specular) {
+    ShaderDefine defines[] = {{"POINT_LIGHT_COUNT", lightCount},
+                              {"SPECULAR", specular}};
+    return {shaderVariant(materialShaders, defines, 2),
+            shaderVariant(materialShaders, NULL, 0)};
+}
+
+// The number of splat layers is always compiled in, it has no general value
+LitVariant terrainVariant(int lightCount, bool specular, int layerCount) {
+    ShaderDefine defines[] = {{"SPLAT_LAYERS", layerCount},
+                              {"POINT_LIGHT_COUNT", lightCount},
+                              {"SPECULAR", specular}};
+    return {shaderVariant(terrainShaders, defines, 3),
+            shaderVariant(terrainShaders, defines, 1)};
+}
+
+// The shader to draw with. A variant seen for the first time is only started
+// and reloadShaders finishes it, so a new light count never stalls a frame.
+// The general variants are built at startup.
+Shader* selectShader(LitVariant variant) {
+    if (!shaderPermutations || !variant.shader->program) return variant.general;
+    return variant.shader;
+}
+
+// Every shader built so far, including each variant of the lit shaders
+std::vector<Shader*> getShaders() {
+    std::vector<Shader*> shaders = {&shader, &skyboxShader, &font_shader,
+                                    &hud_shader};
+    for (auto variants : {&materialShaders, &terrainShaders}) {
+        for (auto& [key, variant] : variants->variants)
+            shaders.push_back(variant.get());
+    }
+    return shaders;
+}
+
+// Resolve the uniform handles of the fixed shaders, again after a reload. The
+// variants of the lit shaders resolve theirs when they are next drawn.
+void resolveUniforms() {
+    skyboxUniforms.model = shaderUniform<glm::mat4>(skyboxShader, "model");
+    skyboxUniforms.tex   = shaderUniform<int>(skyboxShader, "tex");
+    font_resolve_uniforms();
+    hud_resolve_uniforms();
+}
+
+// Rebuild shaders whose sources changed, or all of them when forced. The new
+// programs are only swapped in once they have built without errors, until
+// then the old ones keep drawing.
+void reloadShaders(bool force) {
+    auto now = glfwGetTime();
+    if (force || now - shaderWatchTime > SHADER_WATCH_INTERVAL) {
+        shaderWatchTime = now;
+        for (auto program : getShaders()) {
+            if (force) {
+                shaderBuildStart(*program);
+            } else {
+                shaderReloadIfChanged(*program);
+            }
+        }
+    }
+
+    auto swapped = false;
+    for (auto program : getShaders()) {
+        if (!program->building) continue;
+        if (shaderBuildPoll(*program, false) == SHADER_BUILD_DONE)
+            swapped = true;
+    }
+    if (swapped) resolveUniforms();
+}
+
+// Show the errors of failed shader builds below the interface text. Variants
+// of a shader usually fail the same way, so only the first one is shown.
+void drawShaderErrors() {
+    auto y = HEIGHT - 140.0f;
+    std::vector<std::string> shown;
+    for (auto program : getShaders()) {
+        if (program->log.empty()) continue;
+        if (std::find(shown.begin(), shown.end(), program->fragment_path) !=
+            shown.end())
+            continue;
+        shown.push_back(program->fragment_path);
+
+        font_draw(&interfaceFont, 10, y, glm::vec3{1, 0.2f, 0.2f},
+                  program->fragment_path.c_str());
+        y -= 20.0f;
+
+        size_t start = 0;
+        for (auto lines = 0; lines < 8 && start < program->log.size();
+             lines++) {
+            auto end = program->log.find('\n', start);
+            if (end == std::string::npos) end = program->log.size();
+            auto line = program->log.substr(start, end - start);
+            if (!line.empty()) {
+                font_draw(&interfaceFont, 10, y, glm::vec3{1, 0.2f, 0.2f},
+                          line.c_str());
+                y -= 20.0f;
+            }
+            start = end + 1;
+        }
+    }
+}
+
+// Write the camera and lights of this frame, read by every shader through the
+// blocks bound at UNIFORM_BINDING_CAMERA and UNIFORM_BINDING_LIGHTS
+void writeFrameUniforms() {
+    auto start = glfwGetTime();
+
+    CameraBlock cameraBlock;
+    cameraBlock.projection    = projectionMatrix;
+    cameraBlock.view          = getViewMatrix(&camera, &player);
+    cameraBlock.view_position = camera.position;
+    uniform_buffer_write(&cameraBuffer, &cameraBlock);
+
+    LightsBlock lightsBlock;
+    lightsBlock.dir_light = dir_light;
+    for (auto i = 0; i < POINT_LIGHT_COUNT; i++)
+        lightsBlock.point_light[i] = point_lights[i];
+    uniform_buffer_write(&lightsBuffer, &lightsBlock);
+
+    uniformTime = glfwGetTime() - start;
+}
+
+struct Button {
+    const char* label;
+    float x, y;
+    bool inside; // Under the mouse
+    bool click;
+};
+
+// The buttons of the menu shown, returns how many there are
+int getButtons(Button* buttons) {
+    if (inMainMenu) {
+        buttons[0] = {"Play", WIDTH / 2, HEIGHT - 2 * HEIGHT / 4};
+        buttons[1] = {"Exit", WIDTH / 2, HEIGHT - 3 * HEIGHT / 4};
+        return 2;
+    }
+    if (inMenu) {
+        buttons[0] = {"Continue", WIDTH / 2, HEIGHT - 2 * HEIGHT / 5};
+        buttons[1] = {"Restart", WIDTH / 2, HEIGHT - 3 * HEIGHT / 5};
+        buttons[2] = {"Exit", WIDTH / 2, HEIGHT - 4 * HEIGHT / 5};
+        return 3;
+    }
+    return 0;
+}
+
+void button_update(Font* font, Button* button) {
+    auto width     = font_width(font, button->label);
+    auto x         = button->x;
+    auto y         = button->y;
+    button->inside = false;
+    button->click  = false;
     if (mouse.lastX > x - width * 0.5f && mouse.lastX < x + width * 0.5f) {
         if (mouse.lastY > HEIGHT - (y + 40) && mouse.lastY < HEIGHT - y) {
             int mouseState = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT);
             if (mouseState == GLFW_PRESS) {
-                click = true;
+                button->click = true;
             }
-            inside = true;
+            button->inside = true;
         }
     }
+}
 
+void button_draw(Font* font, Button const& button) {
+    auto width = font_width(font, button.label);
     auto color = glm::vec3{1, 1, 1};
-    if (inside) color = glm::vec3{1, 0, 0};
-    font_draw(&menuFont, x - width * 0.5f, y, color, msg);
+    if (button.inside) color = glm::vec3{1, 0, 0};
+    font_draw(font, button.x - width * 0.5f, button.y, color, button.label);
+}
+
+// Hash of everything drawHud shows, the HUD layer is drawn again whenever it
+// changes
+u64 hashHud(Button const* buttons, int buttonCount) {
+    int state[] = {inMainMenu,
+                   inMenu,
+                   isGameOver,
+                   player.health,
+                   player.score,
+                   player.highScore,
+                   (int)collectibles.size(),
+                   waveNr};
+    auto hash = hash_fnv1a(state, sizeof(state));
+    for (auto i = 0; i < buttonCount; i++)
+        hash = hash_fnv1a(&buttons[i].inside, sizeof(bool), hash);
+    for (auto program : getShaders())
+        hash = hash_fnv1a(program->log.data(), program->log.size(), hash);
+    // A rebuilt text shader has to draw the labels again
+    hash = hash_fnv1a(&font_shader.generation, sizeof(u32), hash);
+    return hash;
+}
+
+void drawHud(Button const* buttons) {
+    font_projection(WIDTH, HEIGHT);
+
+    if (inMainMenu) {
+        if (isGameOver) {
+            auto game_over_width = font_width(&menuFont, "Game Over");
+            font_draw(&menuFont, WIDTH / 2 - game_over_width / 2,
+                      HEIGHT - HEIGHT / 4, "Game Over");
+        } else {
+            auto title_width = font_width(&menuFont, "TSBK07 Project");
+            font_draw(&menuFont, WIDTH / 2 - title_width / 2,
+                      HEIGHT - HEIGHT / 4, "TSBK07 Project");
+        }
+
+        font_drawf(&interfaceFont, 10, HEIGHT - 40, "High score: %i",
+                   player.highScore);
+
+        button_draw(&menuFont, buttons[0]);
+        button_draw(&menuFont, buttons[1]);
+    } else if (inMenu) {
+        auto pause_width = font_width(&menuFont, "Paused");
+        font_draw(&menuFont, WIDTH / 2 - pause_width / 2, HEIGHT - HEIGHT / 5,
+                  "Paused");
+
+        button_draw(&menuFont, buttons[0]);
+        button_draw(&menuFont, buttons[1]);
+        button_draw(&menuFont, buttons[2]);
+    } else {
+        font_drawf(&interfaceFont, 10, HEIGHT - 40, "Health: %i",
+                   player.health);
+
+        font_drawf(&interfaceFont, 10, HEIGHT - 70, "Score: %i (%zi left)",
+                   player.score, collectibles.size());
+
+        font_drawf(&interfaceFont, 10, HEIGHT - 100, "Wave: %i", waveNr);
+    }
+
+    drawShaderErrors();
+}
 
-    return click;
+// The ImGui backend builds its program through the shader cache too
+unsigned int imguiProgramLoad(const char* const* sources, int count) {
+    auto program = shaderCacheLoad(shaderCacheKey(sources, count));
+    if (program) shaderCacheStats.loaded++;
+    return program;
+}
+
+void imguiProgramStore(unsigned int program, const char* const* sources,
+                       int count) {
+    shaderCacheStore(program, shaderCacheKey(sources, count));
+    shaderCacheStats.compiled++;
 }
 
 void init() {
@@ -355,51 +802,132 @@ void init() {
 
     // Setup Platform/Renderer bindings
     ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init("#version 330");
+    ImGui_ImplOpenGL3_ProgramCache programCache = {
+        imguiProgramLoad, shaderCacheHint, imguiProgramStore};
+    ImGui_ImplOpenGL3_Init("#version 330", &programCache);
 
     glEnable(GL_TEXTURE);
-    glEnable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
-
-    shaderCompile(materialShader, "shaders/material.vert",
-                  "shaders/material.frag");
-    shaderCompile(terrainMaterialShader, "shaders/material.vert",
-                  "shaders/terrain_material.frag");
-    shaderCompile(shader, "shaders/main.vert", "shaders/main.frag");
-    shaderCompile(skyboxShader, "shaders/skybox.vert", "shaders/skybox.frag");
-
-    glm::mat4 projectionMatrix{glm::perspective(
-        glm::radians(45.0f), (float)WIDTH / (float)HEIGHT, 0.1f, 100.0f)};
-    shaderBind(materialShader);
-    shaderSetMat4(materialShader, "projection", projectionMatrix);
-    shaderBind(terrainMaterialShader);
-    shaderSetMat4(terrainMaterialShader, "projection", projectionMatrix);
-    shaderBind(shader);
-    shaderSetMat4(shader, "projection", projectionMatrix);
-    shaderBind(skyboxShader);
-    shaderSetMat4(skyboxShader, "projection", projectionMatrix);
+    gl_state_enable(GL_DEPTH_TEST, true);
+    gl_state_enable(GL_CULL_FACE, false);
+
+    const char* terrainLayerFiles[] = {
+        "textures/terrain_texture_01.png",
+        "textures/grass.png",
+        "textures/terrain_texture_02.jpg",
+        "textures/grass2.png",
+    };
+    auto terrainLayerCount =
+        (int)(sizeof(terrainLayerFiles) / sizeof(terrainLayerFiles[0]));
+
+    // The blocks and their structs are declared from their std140
+    // descriptions, the shaders do not declare them themselves
+    auto cameraHeader = std140_glsl_block<CameraBlock>();
+    auto litHeader    = std140_glsl_struct<DirectionalLight>() +
+                        std140_glsl_struct<PointLight>() + cameraHeader +
+                        std140_glsl_block<LightsBlock>() +
+                        std140_glsl_block<MaterialBlock>("material");
+
+    // Every program is handed to the driver before the other assets load, and
+    // only waited on after them
+    shaderInit();
+    auto shaderStart = glfwGetTime();
+    shaderCompileStart(shader, "shaders/main.vert", "shaders/main.frag",
+                       cameraHeader);
+    shaderCompileStart(skyboxShader, "shaders/skybox.vert",
+                       "shaders/skybox.frag", cameraHeader);
+    font_init();
+    hud_init(&hudLayer);
+    scene_cache_init(&sceneCache);
+
+    // Other variants are built when first drawn. Until collectibles spawn the
+    // player's light is the only one in use, and the general variants stand
+    // in for those that are still building.
+    shaderVariantsCreate(materialShaders, "shaders/material.vert",
+                         "shaders/material.frag", litHeader);
+    shaderVariantsCreate(terrainShaders, "shaders/material.vert",
+                         "shaders/terrain_material.frag", litHeader);
+    for (auto variants : {&materialShaders, &terrainShaders}) {
+        shaderVariantsBindBlock(*variants, "Camera", UNIFORM_BINDING_CAMERA);
+        shaderVariantsBindBlock(*variants, "Lights", UNIFORM_BINDING_LIGHTS);
+        shaderVariantsBindBlock(*variants, "Material",
+                                UNIFORM_BINDING_MATERIAL);
+    }
+    auto materialStartup = materialVariant(1, true);
+    auto terrainStartup  = terrainVariant(1, false, terrainLayerCount);
+    Shader* startupShaders[] = {
+        &shader,
+        &skyboxShader,
+        &font_shader,
+        &hud_shader,
+        materialStartup.shader,
+        materialStartup.general,
+        terrainStartup.shader,
+        terrainStartup.general,
+    };
+
+    cameraBuffer = uniform_buffer_create(UNIFORM_BINDING_CAMERA,
+                                         sizeof(CameraBlock));
+    lightsBuffer = uniform_buffer_create(UNIFORM_BINDING_LIGHTS,
+                                         sizeof(LightsBlock));
+
+    MaterialBlock entityMaterial{{1, 1, 1}, {0.1f, 0.1f, 0.1f}, 32.0f};
+    entityMaterialBuffer = uniform_buffer_create(UNIFORM_BINDING_MATERIAL,
+                                                 sizeof(MaterialBlock));
+    uniform_buffer_write(&entityMaterialBuffer, &entityMaterial);
+
+    MaterialBlock terrainMaterial{{1, 1, 1}, {0, 0, 0}, 32.0f};
+    terrainMaterialBuffer = uniform_buffer_create(UNIFORM_BINDING_MATERIAL,
+                                                  sizeof(MaterialBlock));
+    uniform_buffer_write(&terrainMaterialBuffer, &terrainMaterial);
+
+    projectionMatrix = glm::perspective(
+        glm::radians(45.0f), (float)WIDTH / (float)HEIGHT, 0.1f, 100.0f);
+
+    gpu_timer_create(&terrainTimer);
+
+    thread_pool_create(&threadPool);
 
     auto terrain_texture = texture_load("textures/heightmap.png");
     terrainCreate(&terrain, &terrain_texture, terrainScale);
 
-    terrain_splatmap    = texture_load("textures/terrain_splatmap.png");
-    terrain_textures[0] = texture_load("textures/terrain_texture_01.png");
-    terrain_textures[1] = texture_load("textures/terrain_texture_02.jpg");
-    terrain_textures[2] = texture_load("textures/grass.png");
-    terrain_textures[3] = texture_load("textures/grass2.png");
+    const char* splatmapFiles[] = {"textures/terrain_splatmap.png"};
+    terrain_splatmaps = texture_array_load(splatmapFiles, 1, &threadPool,
+                                           TEXTURE_COOK_RGBA8);
+
+    terrain_layers = texture_array_load(terrainLayerFiles, terrainLayerCount,
+                                        &threadPool);
+
+    TextureLoad textureLoads[] = {
+        {"textures/SkyBox512.png", &skyboxTexture},
+    };
+    texture_load_batch(textureLoads,
+                       sizeof(textureLoads) / sizeof(textureLoads[0]),
+                       &threadPool);
+
+    // The entity atlas starts at its coarse levels and streams in the rest
+    const char* entityMaterialFiles[] = {
+        "textures/fur_texture.jpg",
+        "textures/gold_texture.jpg",
+        "textures/rock_texture.jpg",
+        "textures/light_rock_texture.jpg",
+    };
+    texture_atlas_create(&entityAtlas, "entities", entityMaterialFiles, 4);
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    texture_stream_set_view(&textureStreamer, glm::radians(45.0f),
+                            framebufferHeight);
+    texture_stream_add(&textureStreamer, &entityAtlas.texture, "entities",
+                       [](TextureImage* image) {
+                           return texture_atlas_load(&entityAtlas, image);
+                       });
+    texture_stream_start(&textureStreamer, &threadPool);
 
     loadModels();
     loadModel(&skybox, "models/skybox.obj");
-    skyboxTexture = texture_load("textures/SkyBox512.png");
 
     spawnPlayer();
     spawnWalls();
 
-    furTexture         = texture_load("textures/fur_texture.jpg");
-    collectibleTexture = texture_load("textures/gold_texture.jpg");
-    rockTexture        = texture_load("textures/rock_texture.jpg");
-    lightRockTexture   = texture_load("textures/light_rock_texture.jpg");
-
     dir_light.direction = glm::vec3{-0.2f, -1.0f, -1.0f};
     dir_light.ambient   = glm::vec3{0.2f, 0.2f, 0.2f};
     dir_light.diffuse   = glm::vec3{0.5f, 0.5f, 0.5f};
@@ -417,14 +945,215 @@ void init() {
     point_lights[1].diffuse   = glm::vec3(1, 1, 1);
     point_lights[1].quadratic = 1.0f;
 
-    font_init();
     font_load(&menuFont, "fonts/zorque.ttf", 48);
     font_load(&interfaceFont, "fonts/zorque.ttf", 32);
 
+    auto shaderWaitStart = glfwGetTime();
+    shaderCompileFinish(startupShaders,
+                        sizeof(startupShaders) / sizeof(startupShaders[0]));
+    shaderStartupWait = glfwGetTime() - shaderWaitStart;
+    shaderStartupTime = glfwGetTime() - shaderStart;
+    if (printStats) {
+        printf("Startup programs: %.1f ms, %.1f ms waited\n",
+               1000.0 * shaderStartupTime, 1000.0 * shaderStartupWait);
+        // Compare a start without cache/shaders/ against the one after it
+        printf("Shader cache: %i programs loaded, %i compiled, %.1f ms "
+               "building\n",
+               shaderCacheStats.loaded, shaderCacheStats.compiled,
+               1000.0 * shaderCacheStats.time);
+    }
+
+    resolveUniforms();
+    shaderBindBlock(shader, "Camera", UNIFORM_BINDING_CAMERA);
+    shaderBindBlock(skyboxShader, "Camera", UNIFORM_BINDING_CAMERA);
+
     inMainMenu = true;
 }
 
+// Hash of what can still change the scene while a menu is open: textures
+// streaming in, shader variants finishing their builds and the lights, which
+// the debug window edits
+u64 hashScene() {
+    int state[] = {textureStreamer.uploads, shaderCacheStats.loaded,
+                   shaderCacheStats.compiled};
+    auto hash = hash_fnv1a(state, sizeof(state));
+    hash      = hash_fnv1a(&dir_light, sizeof(dir_light), hash);
+    return hash_fnv1a(point_lights, sizeof(point_lights), hash);
+}
+
+// Add the latest terrain pass time to the sum for the variants it was drawn
+// with. The timer reads results a few frames late, so those that arrive
+// right after a toggle are left out.
+void terrainPassTimesUpdate(TerrainPassTimes* times, GpuTimer const* timer) {
+    if (times->variants != shaderPermutations) {
+        times->variants = shaderPermutations;
+        times->skip     = GPU_TIMER_QUERIES;
+    }
+    if (times->results == timer->results) return;
+    times->results = timer->results;
+
+    if (times->skip > 0) {
+        times->skip--;
+        return;
+    }
+    times->time[times->variants] += timer->time;
+    times->frames[times->variants]++;
+}
+
+void terrainPassTimesPrint(TerrainPassTimes const* times) {
+    const char* names[] = {"general variant", "variants per draw"};
+    for (auto i = 1; i >= 0; i--) {
+        if (times->frames[i] == 0) continue;
+        printf("Terrain pass with %s: %.3f ms over %i frames\n", names[i],
+               1000.0 * times->time[i] / times->frames[i], times->frames[i]);
+    }
+}
+
+// Draw the skybox, the entities and the terrain, lit by the first pointLights
+// lights
+void drawScene(int pointLights) {
+    glClearColor(1.0f, 0.0f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    {
+        // Skybox
+        shaderBind(skyboxShader);
+        gl_state_enable(GL_DEPTH_TEST, false);
+
+        texture_bind(&skyboxTexture, 0);
+        shaderSet(skyboxUniforms.tex, 0);
+
+        // Follow the player around
+        auto modelMatrix = glm::translate(glm::mat4(1.0f), player.position);
+        modelMatrix *= glm::scale(glm::vec3{10, 10, 10});
+        shaderSet(skyboxUniforms.model, modelMatrix);
+        drawModel(&skybox);
+
+        gl_state_enable(GL_DEPTH_TEST, true);
+    }
+
+    // Every entity material has a specular term. A variant that has never
+    // built has no program to draw with.
+    auto materialShader = selectShader(materialVariant(pointLights, true));
+    if (materialShader->program) {
+        auto uniforms = getMaterialUniforms(*materialShader);
+        shaderBind(*materialShader);
+
+        // Entities share the atlas, only the entry changes between them.
+        // Without the atlas every group drawn would bind its own texture.
+        auto entityGroups = 0;
+        texture_bind(&entityAtlas.texture, 0);
+        shaderSet(uniforms->tex, 0);
+        uniform_buffer_bind(&entityMaterialBuffer);
+
+        {
+            // Player
+            auto& entry = entityAtlas.entries[ENTITY_MATERIAL_FUR];
+            shaderSet(uniforms->atlas_rect, entry.rect);
+            texture_stream_touch(&textureStreamer, &entityAtlas.texture,
+                                 glm::length(camera.position - player.position),
+                                 2.0f * player.radius, entry.size);
+            glm::mat4 modelMatrix{player.getMatrix()};
+            shaderSet(uniforms->model, modelMatrix);
+            drawModel(&models.bunnyModel);
+            entityGroups++;
+        }
+
+        if (!collectibles.empty()) {
+            // collectible
+            auto& entry = entityAtlas.entries[ENTITY_MATERIAL_GOLD];
+            shaderSet(uniforms->atlas_rect, entry.rect);
+            for (auto& collectible : collectibles) {
+                texture_stream_touch(
+                    &textureStreamer, &entityAtlas.texture,
+                    glm::length(camera.position - collectible.position),
+                    2.0f * collectible.radius, entry.size);
+                glm::mat4 modelMatrix{collectible.getMatrix()};
+                shaderSet(uniforms->model, modelMatrix);
+                drawModel(&models.sphereModel);
+            }
+            entityGroups++;
+        }
+
+        if (!physics.obstacles.empty()) {
+            // obstacle
+            auto& entry = entityAtlas.entries[ENTITY_MATERIAL_ROCK];
+            shaderSet(uniforms->atlas_rect, entry.rect);
+            for (auto& obstacle : physics.obstacles) {
+                texture_stream_touch(
+                    &textureStreamer, &entityAtlas.texture,
+                    glm::length(camera.position - obstacle.position),
+                    2.0f * obstacle.radius, entry.size);
+                glm::mat4 modelMatrix{obstacle.getMatrix()};
+                shaderSet(uniforms->model, modelMatrix);
+                drawModel(&models.sphereModel);
+            }
+            entityGroups++;
+        }
+
+        if (!walls.empty()) {
+            // walls
+            auto& entry = entityAtlas.entries[ENTITY_MATERIAL_LIGHT_ROCK];
+            shaderSet(uniforms->atlas_rect, entry.rect);
+            for (auto& wall : walls) {
+                // Distance to the closest point of the wall
+                auto lower   = wall.position - 0.5f * wall.scale;
+                auto upper   = wall.position + 0.5f * wall.scale;
+                auto closest = glm::clamp(camera.position, lower, upper);
+                texture_stream_touch(&textureStreamer, &entityAtlas.texture,
+                                     glm::length(camera.position - closest),
+                                     std::max(wall.scale.x, wall.scale.z),
+                                     entry.size);
+
+                glm::mat4 modelMatrix{getWallMatrix(&wall)};
+                shaderSet(uniforms->model, modelMatrix);
+                drawModel(&models.cubeModel);
+            }
+            entityGroups++;
+        }
+        entityBindsSaved = entityGroups - 1;
+    }
+
+    // The terrain has no specular term
+    auto terrainShader = selectShader(
+        terrainVariant(pointLights, false, terrain_layers.layer_count));
+    if (terrainShader->program) {
+        auto uniforms = getTerrainUniforms(*terrainShader);
+        shaderBind(*terrainShader);
+
+        texture_bind(&terrain_splatmaps, 0);
+        texture_bind(&terrain_layers, 1);
+
+        auto modelMatrix = glm::mat4(1);
+        shaderSet(uniforms->model, modelMatrix);
+        shaderSet(uniforms->splatmaps, 0);
+        shaderSet(uniforms->layers, 1);
+        uniform_buffer_bind(&terrainMaterialBuffer);
+
+        gpu_timer_begin(&terrainTimer);
+        drawModel(&terrain.model);
+        gpu_timer_end(&terrainTimer);
+        terrainPassTimesUpdate(&terrainPassTimes, &terrainTimer);
+    }
+}
+
+void cpuMeterUpdate(CpuMeter* meter) {
+    auto wall = glfwGetTime();
+    if (wall - meter->wallStart < 1.0) return;
+
+    // std::clock is the processor time of all threads of the process
+    auto cpu = std::clock();
+    meter->utilization =
+        (float)((double)(cpu - meter->cpuStart) / CLOCKS_PER_SEC /
+                (wall - meter->wallStart));
+    meter->wallStart = wall;
+    meter->cpuStart  = cpu;
+}
+
 void display() {
+    reloadShaders(shaderReloadRequested);
+    shaderReloadRequested = false;
+
     // Start the ImGui frame
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
@@ -442,6 +1171,101 @@ void display() {
         ImGui::SliderFloat("Jump power", &player.jumpPower, 0.0f, 1.0f);
         ImGui::SliderFloat("Gravity", &player.gravity, -10.0f, 0.0f);
 
+        if (ImGui::CollapsingHeader("Texture Streaming")) {
+            ImGui::Text("Resident: %llu KB",
+                        (unsigned long long)textureStreamer.resident_bytes /
+                            1024);
+            int budget = textureStreamer.budget / 1024;
+            if (ImGui::SliderInt("Budget (KB)", &budget, 256, 16384)) {
+                textureStreamer.budget = (u64)budget * 1024;
+            }
+            ImGui::Text("Uploads: %i, evictions: %i", textureStreamer.uploads,
+                        textureStreamer.evictions);
+            ImGui::Text("Binds saved by the atlas: %i/frame",
+                        entityBindsSaved);
+        }
+
+        if (ImGui::CollapsingHeader("Uniforms")) {
+            ImGui::Text("Camera and light blocks: %.3f ms/frame",
+                        1000.0 * uniformTime);
+            ImGui::Text("Uploads issued: %i/frame",
+                        shaderUniformStatsLastFrame.issued);
+            ImGui::Text("Uploads suppressed: %i/frame",
+                        shaderUniformStatsLastFrame.suppressed);
+        }
+
+        if (ImGui::CollapsingHeader("GL State")) {
+            ImGui::Text("Calls issued: %i/frame", gl_state.last_frame.issued);
+            ImGui::Text("Calls skipped: %i/frame",
+                        gl_state.last_frame.skipped);
+        }
+
+        if (ImGui::CollapsingHeader("ImGui Backend")) {
+            ImGui::Checkbox("Stream buffers", &g_StreamBuffers);
+            ImGui::Text("Render: %.3f ms (CPU)", 1000.0 * g_RenderTime);
+            ImGui::Text("Buffer reallocations: %i, orphans: %i",
+                        g_StreamReallocations, g_StreamOrphans);
+            ImGui::Text("Uploads without a mapping: %i", g_StreamFallbacks);
+        }
+
+        if (ImGui::CollapsingHeader("HUD")) {
+            ImGui::Text("Redrawn: %i of %i frames", hudLayer.redraws,
+                        hudLayer.frames);
+        }
+
+        if (ImGui::CollapsingHeader("Physics")) {
+            ImGui::Text("Obstacles: %zu", physics.obstacles.size());
+            ImGui::Text("Grid: %i x %i cells", physics.columns, physics.rows);
+            ImGui::Text("Pairs tested: %i, touching: %i",
+                        physics.last_step.pairs, physics.last_step.contacts);
+            ImGui::Text("Step: %.3f ms", 1000.0 * physics.last_step.time);
+        }
+
+        if (ImGui::CollapsingHeader("Idle")) {
+            ImGui::Checkbox("Wait for input in menus", &idleInMenus);
+            ImGui::Text("CPU: %.0f%% of a core", 100.0f * cpuMeter.utilization);
+            ImGui::Text("Scene drawn: %i of %i menu frames",
+                        sceneCache.redraws, sceneCache.frames);
+        }
+
+        if (ImGui::CollapsingHeader("Text")) {
+            ImGui::Text("Draw calls: %i/frame",
+                        font_renderer.last_frame.draw_calls);
+            ImGui::Text("Draw calls unbatched: %i/frame",
+                        font_renderer.last_frame.glyphs);
+            ImGui::Text("Strings cached: %i/frame",
+                        font_renderer.last_frame.cache_hits);
+            ImGui::Text("Strings laid out: %i/frame",
+                        font_renderer.last_frame.cache_misses);
+            ImGui::Text("Glyphs rendered: %i/frame",
+                        font_renderer.last_frame.glyphs_rendered);
+            for (auto& typeface : font_typefaces) {
+                ImGui::Text("%s: %i/%i cells, %zu glyphs known, %i cached",
+                            typeface->filename.c_str(), typeface->cells_used,
+                            FONT_ATLAS_CELLS, typeface->glyphs.size(),
+                            typeface->cached_glyphs);
+            }
+            ImGui::Text("FreeType: %s", ft_lib ? "started" : "not needed");
+            ImGui::Text("CPU: %.3f ms", 1000.0 * font_renderer.last_frame.time);
+        }
+
+        if (ImGui::CollapsingHeader("Shader Permutations")) {
+            ImGui::Checkbox("Variants per draw", &shaderPermutations);
+            ImGui::Text("Terrain pass: %.3f ms (GPU)",
+                        1000.0 * terrainTimer.time);
+            ImGui::Text("Variants built: %i",
+                        (int)(materialShaders.variants.size() +
+                              terrainShaders.variants.size()));
+        }
+
+        if (ImGui::CollapsingHeader("Shader Cache")) {
+            ImGui::Text("Programs: %i from cache, %i compiled",
+                        shaderCacheStats.loaded, shaderCacheStats.compiled);
+            ImGui::Text("Build time: %.1f ms", 1000.0 * shaderCacheStats.time);
+            ImGui::Text("Startup programs: %.1f ms, %.1f ms waited",
+                        1000.0 * shaderStartupTime, 1000.0 * shaderStartupWait);
+        }
+
         if (ImGui::CollapsingHeader("Directional Light")) {
             ImGui::ColorEdit3("Ambient", glm::value_ptr(dir_light.ambient));
             ImGui::ColorEdit3("Diffuse", glm::value_ptr(dir_light.diffuse));
@@ -477,17 +1301,43 @@ void display() {
     }
 #endif
 
+#if defined(GL_INSTRUMENT)
+    // A window of its own, so that instrumented DEMO builds show it as well
+    {
+        ImGui::Begin("GL Calls");
+        auto frame = gl_instrument_last_frame();
+        ImGui::Text("Draw calls: %i (%llu vertices)", frame->draw_calls,
+                    (unsigned long long)frame->vertices);
+        ImGui::Text("Binds: %i", frame->binds);
+        ImGui::Text("State changes: %i", frame->state_changes);
+        ImGui::Text("Uniform uploads: %i (%llu bytes)", frame->uniform_uploads,
+                    (unsigned long long)frame->uniform_bytes);
+        ImGui::Text("Buffer uploads: %i (%llu bytes)", frame->buffer_uploads,
+                    (unsigned long long)frame->buffer_bytes);
+        ImGui::Text("Texture uploads: %i (%llu bytes)", frame->texture_uploads,
+                    (unsigned long long)frame->texture_bytes);
+        if (ImGui::Button("Dump to gl_instrument.csv"))
+            gl_instrument_dump("gl_instrument.csv");
+        ImGui::End();
+    }
+#endif
+
     // Logic for each frame
     double currentFrame{glfwGetTime()};
     frame.deltaTime = currentFrame - frame.lastFrame;
     frame.lastFrame = currentFrame;
 
     if (!inMainMenu && !inMenu) {
-        player.update(&terrain, walls, obstacles, &collectibles,
+        player.update(&terrain, walls, physics.obstacles, &collectibles,
                       frame.deltaTime);
 
-        for (auto& obstacle : obstacles)
-            obstacle.update(&terrain, obstacles, walls, frame.deltaTime);
+        physics_step(&physics, walls, frame.deltaTime);
+        for (auto& obstacle : physics.obstacles) {
+            TerrainPosition terrPos{};
+            terrainGetPosition(&terrain, obstacle.position.x,
+                               obstacle.position.z, &terrPos);
+            obstacle.setGround(terrPos.position, terrPos.normal);
+        }
 
         if (collectibles.size() == 0) {
             waveNr++;
@@ -519,7 +1369,9 @@ void display() {
     auto pli = 1;
     for (auto i = pli; i < POINT_LIGHT_COUNT; i++) {
         point_lights[i].position = glm::vec3{0, 0, 0};
+        point_lights[i].ambient  = glm::vec3{0, 0, 0};
         point_lights[i].diffuse  = glm::vec3{0, 0, 0};
+        point_lights[i].specular = glm::vec3{0, 0, 0};
     }
 
     for (auto& c : collectibles) {
@@ -532,236 +1384,81 @@ void display() {
         }
     }
 
+    writeFrameUniforms();
+
     // Render
     ImGui::Render();
-    glClearColor(1.0f, 0.0f, 1.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    {
-        // Skybox
-        shaderBind(skyboxShader);
-
-        glm::mat4 view{getViewMatrix(&camera, &player)};
-        shaderSetMat4(skyboxShader, "view", view);
-        glDisable(GL_DEPTH_TEST);
-
-        texture_bind(&skyboxTexture, 0);
-        shaderSetTexture(skyboxShader, "tex", 0);
-
-        // Follow the player around
-        auto modelMatrix = glm::translate(glm::mat4(1.0f), player.position);
-        modelMatrix *= glm::scale(glm::vec3{10, 10, 10});
-        shaderSetMat4(skyboxShader, "model", modelMatrix);
-        drawModel(&skybox);
-
-        glEnable(GL_DEPTH_TEST);
-    }
-
-    // Setup MaterialShader for rendering
-    shaderBind(materialShader);
-
-    glm::mat4 view{getViewMatrix(&camera, &player)};
-    shaderSetMat4(materialShader, "view", view);
-    shaderSetVec3(materialShader, "view_position", camera.position);
-
-    shaderSetVec3(materialShader, "dir_light.direction", dir_light.direction);
-    shaderSetVec3(materialShader, "dir_light.ambient", dir_light.ambient);
-    shaderSetVec3(materialShader, "dir_light.diffuse", dir_light.diffuse);
-    shaderSetVec3(materialShader, "dir_light.specular", dir_light.specular);
-
-    for (auto i = 0; i < POINT_LIGHT_COUNT; i++) {
-        shaderSetVec3(materialShader, "point_light", i, "position",
-                      point_lights[i].position);
-        shaderSetVec3(materialShader, "point_light", i, "ambient",
-                      point_lights[i].ambient);
-        shaderSetVec3(materialShader, "point_light", i, "diffuse",
-                      point_lights[i].diffuse);
-        shaderSetVec3(materialShader, "point_light", i, "specular",
-                      point_lights[i].specular);
-        shaderSetFloat(materialShader, "point_light", i, "constant",
-                       point_lights[i].constant);
-        shaderSetFloat(materialShader, "point_light", i, "linear",
-                       point_lights[i].linear);
-        shaderSetFloat(materialShader, "point_light", i, "quadratic",
-                       point_lights[i].quadratic);
-    }
-
-    {
-        // Player
-        texture_bind(&furTexture, 0);
-        glm::mat4 modelMatrix{player.getMatrix()};
-        shaderSetMat4(materialShader, "model", modelMatrix);
-        shaderSetTexture(materialShader, "tex", 0);
-        shaderSetVec3(materialShader, "material.diffuse", glm::vec3{1, 1, 1});
-        shaderSetVec3(materialShader, "material.specular",
-                      glm::vec3{0.1, 0.1, 0.1});
-        shaderSetFloat(materialShader, "material.shininess", 32.0f);
-        drawModel(&models.bunnyModel);
-    }
-
-    {
-        // collectible
-        texture_bind(&collectibleTexture, 0);
-        shaderSetTexture(materialShader, "tex", 0);
-        shaderSetVec3(materialShader, "material.diffuse", glm::vec3{1, 1, 1});
-        shaderSetVec3(materialShader, "material.specular",
-                      glm::vec3{0.1, 0.1, 0.1});
-        shaderSetFloat(materialShader, "material.shininess", 32.0f);
-
-        for (auto& collectible : collectibles) {
-            glm::mat4 modelMatrix{collectible.getMatrix()};
-            shaderSetMat4(materialShader, "model", modelMatrix);
-            drawModel(&models.sphereModel);
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+
+    // The scene is frozen while a menu is open, so it is only drawn again
+    // when something hashScene covers or the size of the window changed
+    auto paused = inMainMenu || inMenu;
+    if (!paused) {
+        scene_cache_invalidate(&sceneCache);
+        drawScene(pli);
+    } else {
+        if (scene_cache_begin(&sceneCache, hashScene(), width, height)) {
+            drawScene(pli);
+            scene_cache_end(&sceneCache);
         }
+        scene_cache_draw(&sceneCache);
     }
 
     {
-        // obstacle
-        texture_bind(&rockTexture, 0);
-        shaderSetTexture(materialShader, "tex", 0);
-        shaderSetVec3(materialShader, "material.diffuse", glm::vec3{1, 1, 1});
-        shaderSetVec3(materialShader, "material.specular",
-                      glm::vec3{0.1, 0.1, 0.1});
-        shaderSetFloat(materialShader, "material.shininess", 32.0f);
-        for (auto& obstacle : obstacles) {
-            glm::mat4 modelMatrix{obstacle.getMatrix()};
-            shaderSetMat4(materialShader, "model", modelMatrix);
-            drawModel(&models.sphereModel);
+        // Menus and HUD. The buttons are hit tested every frame, but the text
+        // is only drawn again when something it shows has changed.
+        Button buttons[3];
+        auto buttonCount = getButtons(buttons);
+        for (auto i = 0; i < buttonCount; i++)
+            button_update(&menuFont, &buttons[i]);
+
+        if (hud_begin(&hudLayer, hashHud(buttons, buttonCount), width,
+                      height)) {
+            drawHud(buttons);
+            hud_end(&hudLayer);
         }
-    }
-
-    {
-        // walls
-        texture_bind(&lightRockTexture, 0);
-        for (auto& wall : walls) {
-            glm::mat4 modelMatrix{getWallMatrix(&wall)};
-            shaderSetMat4(materialShader, "model", modelMatrix);
-            shaderSetTexture(materialShader, "tex", 0);
-            shaderSetVec3(materialShader, "material.diffuse",
-                          glm::vec3{1, 1, 1});
-            shaderSetVec3(materialShader, "material.specular",
-                          glm::vec3{0.1, 0.1, 0.1});
-            shaderSetFloat(materialShader, "material.shininess", 32.0f);
-            drawModel(&models.cubeModel);
-        }
-    }
-
-    {
-        shaderBind(terrainMaterialShader);
-        glm::mat4 view{getViewMatrix(&camera, &player)};
-        shaderSetMat4(terrainMaterialShader, "view", view);
-        shaderSetVec3(terrainMaterialShader, "view_position", camera.position);
-
-        shaderSetVec3(terrainMaterialShader, "dir_light.direction",
-                      dir_light.direction);
-        shaderSetVec3(terrainMaterialShader, "dir_light.ambient",
-                      dir_light.ambient);
-        shaderSetVec3(terrainMaterialShader, "dir_light.diffuse",
-                      dir_light.diffuse);
-        shaderSetVec3(terrainMaterialShader, "dir_light.specular",
-                      dir_light.specular);
-
-        for (auto i = 0; i < POINT_LIGHT_COUNT; i++) {
-            shaderSetVec3(terrainMaterialShader, "point_light", i, "position",
-                          point_lights[i].position);
-            shaderSetVec3(terrainMaterialShader, "point_light", i, "ambient",
-                          point_lights[i].ambient);
-            shaderSetVec3(terrainMaterialShader, "point_light", i, "diffuse",
-                          point_lights[i].diffuse);
-            shaderSetVec3(terrainMaterialShader, "point_light", i, "specular",
-                          point_lights[i].specular);
-            shaderSetFloat(terrainMaterialShader, "point_light", i, "constant",
-                           point_lights[i].constant);
-            shaderSetFloat(terrainMaterialShader, "point_light", i, "linear",
-                           point_lights[i].linear);
-            shaderSetFloat(terrainMaterialShader, "point_light", i, "quadratic",
-                           point_lights[i].quadratic);
-        }
-
-        texture_bind(&terrain_splatmap, 0);
-        texture_bind(&terrain_textures[0], 1);
-        texture_bind(&terrain_textures[1], 2);
-        texture_bind(&terrain_textures[2], 3);
-        texture_bind(&terrain_textures[3], 4);
-
-        auto modelMatrix = glm::mat4(1);
-        shaderSetMat4(terrainMaterialShader, "model", modelMatrix);
-        shaderSetTexture(terrainMaterialShader, "splatmap", 0);
-        shaderSetTexture(terrainMaterialShader, "textures[0]", 1);
-        shaderSetTexture(terrainMaterialShader, "textures[1]", 2);
-        shaderSetTexture(terrainMaterialShader, "textures[2]", 3);
-        shaderSetTexture(terrainMaterialShader, "textures[3]", 4);
-
-        shaderSetVec3(terrainMaterialShader, "material.diffuse",
-                      glm::vec3{1, 1, 1});
-        shaderSetVec3(terrainMaterialShader, "material.specular",
-                      glm::vec3{0.0, 0.0, 0.0});
-        shaderSetFloat(terrainMaterialShader, "material.shininess", 32.0f);
-        drawModel(&terrain.model);
-    }
-
-    {
-        // Text
-        font_projection(WIDTH, HEIGHT);
+        hud_composite(&hudLayer);
 
+        // The next frame shows the screen a click leads to
         if (inMainMenu) {
-            if (isGameOver) {
-                auto game_over_width = font_width(&menuFont, "Game Over");
-                font_draw(&menuFont, WIDTH / 2 - game_over_width / 2,
-                          HEIGHT - HEIGHT / 4, "Game Over");
-            } else {
-                auto title_width = font_width(&menuFont, "TSBK07 Project");
-                font_draw(&menuFont, WIDTH / 2 - title_width / 2,
-                          HEIGHT - HEIGHT / 4, "TSBK07 Project");
-            }
-
-            font_drawf(&interfaceFont, 10, HEIGHT - 40, "High score: %i",
-                       player.highScore);
-
-            if (button_draw(&menuFont, WIDTH / 2, HEIGHT - 2 * HEIGHT / 4,
-                            "Play")) {
-                restartGame();
-            }
-            if (button_draw(&menuFont, WIDTH / 2, HEIGHT - 3 * HEIGHT / 4,
-                            "Exit")) {
-                glfwSetWindowShouldClose(window, GL_TRUE);
-            }
+            if (buttons[0].click) restartGame();
+            if (buttons[1].click) glfwSetWindowShouldClose(window, GL_TRUE);
         } else if (inMenu) {
-            auto pause_width = font_width(&menuFont, "Paused");
-            font_draw(&menuFont, WIDTH / 2 - pause_width / 2,
-                      HEIGHT - HEIGHT / 5, "Paused");
-
-            if (button_draw(&menuFont, WIDTH / 2, HEIGHT - 2 * HEIGHT / 5,
-                            "Continue")) {
-                continueGame();
-            }
-            if (button_draw(&menuFont, WIDTH / 2, HEIGHT - 3 * HEIGHT / 5,
-                            "Restart")) {
-                restartGame();
-            }
-            if (button_draw(&menuFont, WIDTH / 2, HEIGHT - 4 * HEIGHT / 5,
-                            "Exit")) {
-                glfwSetWindowShouldClose(window, GL_TRUE);
-            }
-        } else {
-            font_drawf(&interfaceFont, 10, HEIGHT - 40, "Health: %i",
-                       player.health);
-
-            font_drawf(&interfaceFont, 10, HEIGHT - 70, "Score: %i (%zi left)",
-                       player.score, collectibles.size());
-
-            font_drawf(&interfaceFont, 10, HEIGHT - 100, "Wave: %i", waveNr);
+            if (buttons[0].click) continueGame();
+            if (buttons[1].click) restartGame();
+            if (buttons[2].click) glfwSetWindowShouldClose(window, GL_TRUE);
         }
     }
 
     // Render ImGui frame
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
+    texture_stream_update(&textureStreamer);
+    gl_state_end_frame();
+    shaderEndFrame();
+    font_end_frame();
+#if defined(GL_INSTRUMENT)
+    gl_instrument_end_frame();
+#endif
+
     glfwSwapBuffers(window);
-    glfwPollEvents();
+    cpuMeterUpdate(&cpuMeter);
+
+    // Nothing changes in a menu until the player does something, a click
+    // or a key press wakes the game up right away
+    if (idleInMenus && (inMainMenu || inMenu)) {
+        glfwWaitEventsTimeout(IDLE_TICK);
+    } else {
+        glfwPollEvents();
+    }
 }
 
-int main() {
+int main(int argc, char** argv) {
+    for (auto i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) printStats = true;
+    }
+
     // Initialize program
     initGLFW();
     initGLEW();
@@ -778,6 +1475,14 @@ int main() {
     cleanUpModel(&models.cubeModel);
     cleanUpModel(&terrain.model);
     cleanUpModel(&skybox);
+    font_free();
+
+    thread_pool_destroy(&threadPool);
+    if (printStats) terrainPassTimesPrint(&terrainPassTimes);
+
+#if defined(GL_INSTRUMENT)
+    gl_instrument_dump("gl_instrument.csv");
+#endif
 
     // Terminate GLFW, clearing any resources allocated by GLFW.
     glfwTerminate();
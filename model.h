@@ -12,6 +12,7 @@
 #include <vector>
 
 #include "error.h"
+#include "gl_state.h"
 #include "type.h"
 
 struct Vertex {
@@ -39,13 +40,13 @@ static void modelCreate(Model* model, const std::vector<Vertex>& vertices,
     glGenBuffers(1, &model->VBO);
     glGenBuffers(1, &model->EBO);
 
-    glBindVertexArray(model->VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, model->VBO);
+    gl_state_bind_vertex_array(model->VAO);
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, model->VBO);
 
     glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
                  &vertices[0], GL_STATIC_DRAW);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->EBO);
+    gl_state_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, model->EBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(u32),
                  &indices[0], GL_STATIC_DRAW);
 
@@ -61,8 +62,6 @@ static void modelCreate(Model* model, const std::vector<Vertex>& vertices,
     glEnableVertexAttribArray(2);
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
                           (void*)offsetof(Vertex, texCoords));
-
-    glBindVertexArray(0);
 }
 
 static void modelCreate(Model* model, int vertexCount, GLfloat* positions,
@@ -170,10 +169,10 @@ void loadModel(Model* model, std::string file_name) {
     modelCreate(model, vertices, indices);
 }
 
+// The vertex array stays bound, so drawing the same model again binds nothing
 void drawModel(Model* model) {
-    glBindVertexArray(model->VAO);
+    gl_state_bind_vertex_array(model->VAO);
     glDrawElements(GL_TRIANGLES, model->indexCount, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
 }
 
 void cleanUpModel(Model* model) {
@@ -4,41 +4,64 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/component_wise.hpp>
+#include <vector>
 
 #include "math_utils.h"
-#include "terrain.h"
 #include "wall.h"
 
+// Obstacles are owned and moved by a PhysicsWorld, see physics.h
+
 class Obstacle {
   public:
     glm::vec3 velocity{3.0f, 0.0f, 3.0f};
     glm::vec3 position;
     float radius;
-    int myId;
 
     Obstacle(glm::vec3 position, glm::vec3 normal, glm::vec3 _radius)
         : position{position}, normal{normal} {
-        static int id{0};
-        myId   = id++;
         radius = scale * glm::compAdd(_radius) / 3.0f;
     }
 
-    void update(Terrain* terrain, std::vector<Obstacle> obstacles,
-                std::vector<Wall> walls, float deltaTime) {
+    void move(std::vector<Wall> const& walls, float deltaTime) {
         position += velocity * deltaTime;
-
         checkWallCollisions(walls);
-        checkObstacleCollisions(obstacles);
-
-        TerrainPosition terrPos{};
-        terrainGetPosition(terrain, position.x, position.z, &terrPos);
-        position = terrPos.position;
-        normal   = terrPos.normal;
 
         angle -= glm::length(velocity) * deltaTime;
         angle = wrapRadAngle(angle);
     }
 
+    // Place the obstacle on the ground below it
+    void setGround(glm::vec3 groundPosition, glm::vec3 groundNormal) {
+        position = groundPosition;
+        normal   = groundNormal;
+    }
+
+    // Push two overlapping obstacles apart and bounce them off each other.
+    // They roll on the ground, so only the horizontal distance between them
+    // counts. Returns whether they overlapped.
+    bool collide(Obstacle& obstacle) {
+        glm::vec3 offset{position - obstacle.position};
+        offset.y = 0.0f;
+        float distance{glm::length(offset)};
+        float totalRadius{radius + obstacle.radius};
+        if (distance >= totalRadius || distance == 0.0f) return false;
+
+        glm::vec3 direction{offset / distance};
+        float overlap{0.5f * (totalRadius - distance)};
+        position += overlap * direction;
+        obstacle.position -= overlap * direction;
+
+        // Equal masses trade their velocities along the line between them,
+        // unless they are already moving apart
+        float closing{glm::dot(velocity - obstacle.velocity, direction)};
+        if (closing < 0.0f) {
+            velocity -= closing * direction;
+            obstacle.velocity += closing * direction;
+        }
+        return true;
+    }
+
     glm::mat4 getMatrix() {
         glm::vec3 pos{position};
         pos.y += radius;
@@ -56,7 +79,7 @@ class Obstacle {
     float angle;
     float scale{1.0f};
 
-    void checkWallCollisions(std::vector<Wall> walls) {
+    void checkWallCollisions(std::vector<Wall> const& walls) {
         if (position.z - radius <= walls.at(0).position.z + walls.at(0).width) {
             velocity.z = -velocity.z;
             position.z = radius + walls.at(0).position.z + walls.at(0).width;
@@ -74,35 +97,6 @@ class Obstacle {
             position.x = walls.at(3).position.x - walls.at(3).width - radius;
         }
     }
-
-    void checkObstacleCollisions(std::vector<Obstacle> obstacles) {
-        for (auto& obstacle : obstacles) {
-            if (myId != obstacle.myId) {
-                float distance{glm::length(position - obstacle.position)};
-                float totalRadius{radius + obstacle.radius};
-                if (distance < totalRadius) {
-                    float overlap{0.5f * (distance - totalRadius)};
-
-                    position -=
-                        overlap * (position - obstacle.position) / distance;
-                    obstacle.position +=
-                        overlap * (position - obstacle.position) / distance;
-
-                    glm::vec3 v1{velocity};
-                    glm::vec3 v2{obstacle.velocity};
-                    glm::vec3 x1{position};
-                    glm::vec3 x2{obstacle.position};
-
-                    velocity = v1 - (glm::dot(v1 - v2, x1 - x2) /
-                                     glm::length(x1 - x2)) *
-                                        (x1 - x2);
-                    obstacle.velocity = v2 - (glm::dot(v2 - v1, x2 - x1) /
-                                              glm::length(x2 - x1)) *
-                                                 (x2 - x1);
-                }
-            }
-        }
-    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,152 @@
+#pragma once
+#if !defined(PHYSICS_H)
+#define PHYSICS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "obstacle.h"
+#include "type.h"
+#include "wall.h"
+
+// The obstacles are owned and moved by a world. Every step moves them and
+// bounces them off the walls, then sorts them into a uniform grid over the
+// arena, with cells as wide as the largest obstacle. Obstacles can only touch
+// if they are in the same or neighbouring cells, so every pair that can touch
+// is found once, by looking at each cell and the four neighbours after it,
+// and resolved right away.
+
+// Cells in the grid at most, larger arenas get larger cells
+#define PHYSICS_MAX_CELLS (1 << 20)
+
+struct PhysicsStats {
+    int pairs;    // Pairs of obstacles close enough to be tested
+    int contacts; // Pairs that overlapped and were pushed apart
+    double time;  // CPU seconds spent in the step
+};
+
+struct PhysicsWorld {
+    std::vector<Obstacle> obstacles;
+
+    // The grid, built again every step
+    glm::vec2 origin; // Corner of the arena with the lowest x and z
+    float cell_size;
+    int columns, rows;
+    std::vector<int> cell_starts;    // First entry of every cell, and the end
+    std::vector<int> cell_obstacles; // Obstacles sorted by cell
+    std::vector<int> obstacle_cells; // Cell of every obstacle
+
+    PhysicsStats last_step;
+};
+
+// Fit the grid to the arena inside the walls and to the largest obstacle
+static void physics_grid_fit(PhysicsWorld* world,
+                             std::vector<Wall> const& walls) {
+    glm::vec2 lower{walls.at(1).position.x + walls.at(1).width,
+                    walls.at(0).position.z + walls.at(0).width};
+    glm::vec2 upper{walls.at(3).position.x - walls.at(3).width,
+                    walls.at(2).position.z - walls.at(2).width};
+
+    auto radius = 0.0f;
+    for (auto& obstacle : world->obstacles)
+        radius = std::max(radius, obstacle.radius);
+
+    auto width  = std::max(upper.x - lower.x, 0.0f);
+    auto height = std::max(upper.y - lower.y, 0.0f);
+    auto size   = std::max(2.0f * radius, 1e-3f);
+    size        = std::max(size, std::sqrt(width * height / PHYSICS_MAX_CELLS));
+
+    world->origin    = lower;
+    world->cell_size = size;
+    world->columns   = std::max(1, (int)std::ceil(width / size));
+    world->rows      = std::max(1, (int)std::ceil(height / size));
+}
+
+static int physics_cell(PhysicsWorld* world, glm::vec3 position) {
+    auto column = (int)std::floor((position.x - world->origin.x) /
+                                  world->cell_size);
+    auto row    = (int)std::floor((position.z - world->origin.y) /
+                                  world->cell_size);
+    column      = std::clamp(column, 0, world->columns - 1);
+    row         = std::clamp(row, 0, world->rows - 1);
+    return row * world->columns + column;
+}
+
+// Sort the obstacles by cell, counting the obstacles of every cell first
+static void physics_grid_build(PhysicsWorld* world) {
+    auto count  = (int)world->obstacles.size();
+    auto cells  = world->columns * world->rows;
+    auto& start = world->cell_starts;
+
+    start.assign(cells + 1, 0);
+    world->obstacle_cells.resize(count);
+    for (auto i = 0; i < count; i++) {
+        auto cell = physics_cell(world, world->obstacles[i].position);
+        start[cell + 1]++;
+        world->obstacle_cells[i] = cell;
+    }
+    for (auto cell = 0; cell < cells; cell++) start[cell + 1] += start[cell];
+
+    // Fill every cell from its start, which leaves each start at the start of
+    // the next cell, then move them back
+    world->cell_obstacles.resize(count);
+    for (auto i = 0; i < count; i++)
+        world->cell_obstacles[start[world->obstacle_cells[i]]++] = i;
+    for (auto cell = cells; cell > 0; cell--) start[cell] = start[cell - 1];
+    start[0] = 0;
+}
+
+static void physics_pair(Obstacle& a, Obstacle& b, PhysicsStats* stats) {
+    stats->pairs++;
+    if (a.collide(b)) stats->contacts++;
+}
+
+static void physics_step(PhysicsWorld* world, std::vector<Wall> const& walls,
+                         float deltaTime) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto& obstacle : world->obstacles) obstacle.move(walls, deltaTime);
+
+    physics_grid_fit(world, walls);
+    physics_grid_build(world);
+
+    // The neighbours after a cell, so that every pair of cells is visited once
+    const int neighbours[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+    PhysicsStats stats{};
+    auto& starts    = world->cell_starts;
+    auto& sorted    = world->cell_obstacles;
+    auto& obstacles = world->obstacles;
+    for (auto row = 0; row < world->rows; row++) {
+        for (auto column = 0; column < world->columns; column++) {
+            auto cell = row * world->columns + column;
+            for (auto i = starts[cell]; i < starts[cell + 1]; i++) {
+                auto& obstacle = obstacles[sorted[i]];
+                for (auto j = i + 1; j < starts[cell + 1]; j++)
+                    physics_pair(obstacle, obstacles[sorted[j]], &stats);
+
+                for (auto& neighbour : neighbours) {
+                    auto x = column + neighbour[0];
+                    auto y = row + neighbour[1];
+                    if (x < 0 || x >= world->columns || y >= world->rows)
+                        continue;
+
+                    auto other = y * world->columns + x;
+                    for (auto j = starts[other]; j < starts[other + 1]; j++)
+                        physics_pair(obstacle, obstacles[sorted[j]], &stats);
+                }
+            }
+        }
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    stats.time       = elapsed.count();
+    world->last_step = stats;
+}
+
+#endif
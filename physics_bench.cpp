@@ -0,0 +1,100 @@
+// Obstacle physics benchmark. Steps worlds of increasing size, with the
+// obstacles spread as densely as in a late wave, and prints the time per step
+// of the grid in physics.h against the way obstacles used to update:
+//
+// grid:   physics_step, which only tests obstacles in neighbouring cells
+// copies: every obstacle tests all others, on a copy of the whole list
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+#include "physics.h"
+
+#define BENCH_STEPS 10
+#define BENCH_RADIUS 0.5f
+// Arena area per obstacle
+#define BENCH_AREA 20.0f
+// Worlds larger than this are not stepped the old way, it would take hours
+#define BENCH_COPIES_LIMIT 1000
+
+static const int bench_counts[] = {10, 1000, 100000};
+
+// Walls around a square arena, laid out like the ones around the terrain
+static std::vector<Wall> bench_walls(float size) {
+    std::vector<Wall> walls(4);
+    walls.at(0).position = {size / 2, 0.0f, 0.0f};
+    walls.at(1).position = {0.0f, 0.0f, size / 2};
+    walls.at(2).position = {size / 2, 0.0f, size};
+    walls.at(3).position = {size, 0.0f, size / 2};
+    return walls;
+}
+
+static void bench_spawn(PhysicsWorld* world, int count, float size) {
+    std::mt19937 random{1};
+    std::uniform_real_distribution<float> position(2.0f, size - 2.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 2.0f * (float)M_PI);
+
+    world->obstacles.clear();
+    for (auto i = 0; i < count; i++) {
+        glm::vec3 at{position(random), 0.0f, position(random)};
+        Obstacle obstacle{at, glm::vec3{0, 1, 0}, glm::vec3{BENCH_RADIUS}};
+        auto a            = angle(random);
+        obstacle.velocity = 4.0f * glm::vec3{std::cos(a), 0.0f, std::sin(a)};
+        world->obstacles.push_back(obstacle);
+    }
+}
+
+// A step as Obstacle::update used to take it, by value
+static void bench_step_copies(std::vector<Obstacle>& obstacles,
+                              std::vector<Wall> const& walls,
+                              float deltaTime) {
+    for (size_t i = 0; i < obstacles.size(); i++) {
+        auto& obstacle = obstacles[i];
+        obstacle.move(walls, deltaTime);
+
+        auto others = obstacles;
+        for (size_t j = 0; j < others.size(); j++) {
+            if (j != i) obstacle.collide(others[j]);
+        }
+    }
+}
+
+int main() {
+    printf("%d steps per world, %.0f units of arena per obstacle\n\n",
+           BENCH_STEPS, BENCH_AREA);
+    printf("obstacles  grid ms/step  pairs/step  copies ms/step\n");
+
+    for (auto count : bench_counts) {
+        auto size  = std::sqrt(count * BENCH_AREA) + 4.0f;
+        auto walls = bench_walls(size);
+
+        PhysicsWorld world{};
+        bench_spawn(&world, count, size);
+        double grid = 0;
+        long pairs  = 0;
+        for (auto step = 0; step < BENCH_STEPS; step++) {
+            physics_step(&world, walls, 1.0f / 60.0f);
+            grid += world.last_step.time;
+            pairs += world.last_step.pairs;
+        }
+
+        printf("%9d  %12.3f  %10ld", count, 1000.0 * grid / BENCH_STEPS,
+               pairs / BENCH_STEPS);
+
+        if (count > BENCH_COPIES_LIMIT) {
+            printf("  %14s\n", "skipped");
+            continue;
+        }
+
+        bench_spawn(&world, count, size);
+        auto start = std::chrono::steady_clock::now();
+        for (auto step = 0; step < BENCH_STEPS; step++)
+            bench_step_copies(world.obstacles, walls, 1.0f / 60.0f);
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        printf("  %14.3f\n", elapsed.count() / BENCH_STEPS);
+    }
+
+    return 0;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#if !defined(RECT_PACK_H)
+#define RECT_PACK_H
+
+// The rectangle packer bundled with ImGui. Its implementation section has no
+// include guard of its own, so always include it through this header.
+// Compiled as static functions, not all of which the atlas calls, so those it
+// does not call are kept from warning.
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "imgui/imstb_rectpack.h"
+#pragma GCC diagnostic pop
+
+#endif
@@ -0,0 +1,102 @@
+#pragma once
+#if !defined(SCENE_CACHE_H)
+#define SCENE_CACHE_H
+
+#include "error.h"
+#include "gl_state.h"
+#include "type.h"
+
+// Nothing in the scene moves while a menu is open, so it is drawn once into a
+// framebuffer of its own and copied to the screen for every frame after that,
+// until the size of the screen or the key of what it shows changes.
+
+struct SceneCache {
+    unsigned int framebuffer;
+    unsigned int texture; // Color of the scene
+    unsigned int depth;   // Renderbuffer the scene is depth tested against
+    int width, height;
+    u64 key;    // Of what the texture shows
+    bool drawn; // Whether the texture shows anything yet
+
+    int frames;  // Frames copied from the cache
+    int redraws; // Frames the scene was drawn into the cache
+};
+
+static void scene_cache_init(SceneCache* cache) {
+    *cache = {};
+    glGenFramebuffers(1, &cache->framebuffer);
+    glGenTextures(1, &cache->texture);
+    glGenRenderbuffers(1, &cache->depth);
+}
+
+// Draw the scene again the next time the cache is used
+static void scene_cache_invalidate(SceneCache* cache) {
+    cache->drawn = false;
+}
+
+// Whether the scene has to be drawn again, for a framebuffer of width by
+// height and contents described by key. If so the cache is bound for
+// drawing, and scene_cache_end has to be called once the scene is drawn.
+// Nothing is drawn for a minimized window, which has no pixels.
+static bool scene_cache_begin(SceneCache* cache, u64 key, int width,
+                              int height) {
+    if (width <= 0 || height <= 0) return false;
+    cache->frames++;
+
+    if (width != cache->width || height != cache->height) {
+        cache->width  = width;
+        cache->height = height;
+        cache->drawn  = false;
+
+        gl_state_bind_texture(0, GL_TEXTURE_2D, cache->texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glBindRenderbuffer(GL_RENDERBUFFER, cache->depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width,
+                              height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, cache->framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, cache->texture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                  GL_RENDERBUFFER, cache->depth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+            GL_FRAMEBUFFER_COMPLETE) {
+            error("Scene cache framebuffer incomplete!\n");
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    if (cache->drawn && cache->key == key) return false;
+
+    cache->key   = key;
+    cache->drawn = true;
+    cache->redraws++;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, cache->framebuffer);
+    glViewport(0, 0, width, height);
+    return true;
+}
+
+static void scene_cache_end(SceneCache* cache) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, cache->width, cache->height);
+}
+
+// Copy the cached scene to the screen, in place of drawing it. The depth
+// buffer of the screen is left as it was, only the HUD and ImGui, which do
+// not depth test, are drawn over the copy.
+static void scene_cache_draw(SceneCache* cache) {
+    if (cache->width <= 0 || cache->height <= 0) return;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, cache->framebuffer);
+    glBlitFramebuffer(0, 0, cache->width, cache->height, 0, 0, cache->width,
+                      cache->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+#endif
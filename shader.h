@@ -2,169 +2,630 @@
 #if !defined(SHADER_H)
 #define SHADER_H
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
 #include "error.h"
+#include "gl_state.h"
+#include "hash.h"
 #include "string.h"
 
+// A uniform keeps its value in the program until it is set again, so a value
+// only has to be uploaded when it differs from the last one
+struct ShaderUniformValue {
+    u32 size; // Zero until the uniform is first set
+    u8 data[sizeof(glm::mat4)];
+};
+
+// A program that has been submitted to the driver but not checked yet
+struct ShaderBuild {
+    u32 program;
+    u32 vertex;
+    u32 fragment;
+    u64 key;     // Key in the program binary cache
+    bool cached; // Loaded from the cache, already linked
+    double time; // Seconds spent on it so far
+};
+
+enum ShaderBuildStatus {
+    SHADER_BUILD_PENDING,
+    SHADER_BUILD_FAILED,
+    SHADER_BUILD_DONE,
+};
+
 struct Shader {
     u32 program;
     u32 vertex;
     u32 fragment;
+
+    // Locations of the active uniforms by name, filled in at link time
+    std::unordered_map<std::string, int> uniforms;
+
+    // Uniform blocks and their binding points, applied to every new program
+    std::vector<std::pair<std::string, u32>> blocks;
+
+    std::string vertex_path;
+    std::string fragment_path;
+    std::string header; // Inserted after the #version line of both stages
+    std::filesystem::file_time_type modified; // Of the sources last built
+
+    ShaderBuild build;
+    bool building{false};
+
+    u32 generation{0}; // Bumped whenever the program is replaced
+    std::string log;   // Errors of the last failed build
+
+    // Last value uploaded to each uniform location of the program
+    std::vector<ShaderUniformValue> values;
+};
+
+// The shader bound last with shaderBind, whose uniforms the handles set
+Shader* shaderBound{nullptr};
+
+struct ShaderUniformStats {
+    int issued;     // Uploads that reached GL
+    int suppressed; // Uploads of the value the uniform already had
+};
+
+ShaderUniformStats shaderUniformStats;          // So far this frame
+ShaderUniformStats shaderUniformStatsLastFrame; // During the previous frame
+
+// A resolved uniform location. Setting a uniform through a handle builds no
+// strings and asks the driver for nothing, so use handles for uniforms that
+// are set every frame.
+template <typename T>
+struct ShaderUniform {
+    int location{-1};
 };
 
-// Compile vertex and fragment shader into a program shader
-static bool shaderCompile(Shader& shader, std::string const& vertex_path,
-                          std::string const& fragment_path) {
-    // TODO: Clean up data for early returns
+// Linked programs are stored in cache/shaders/ with glGetProgramBinary, named
+// after a hash of their sources and the driver. A binary the driver no longer
+// accepts is compiled again from source and replaced.
+#define SHADER_CACHE_DIRECTORY "cache/shaders/"
+
+struct ShaderCacheStats {
+    int loaded;   // Programs read from the cache
+    int compiled; // Programs compiled from source
+    double time;  // Seconds spent building programs
+};
+
+ShaderCacheStats shaderCacheStats;
+
+// Hash the sources of a program together with the driver that builds it
+static u64 shaderCacheKey(const char* const* sources, int count) {
+    const GLenum strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+
+    u64 hash = HASH_FNV1A_BASIS;
+    for (auto name : strings) {
+        auto string = (const char*)glGetString(name);
+        if (string) hash = hash_fnv1a(string, strlen(string) + 1, hash);
+    }
+    for (auto i = 0; i < count; i++) {
+        hash = hash_fnv1a(sources[i], strlen(sources[i]) + 1, hash);
+    }
+    return hash;
+}
+
+static std::string shaderCachePath(u64 key) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return std::string(SHADER_CACHE_DIRECTORY) + name;
+}
+
+// Create a program from its cached binary, or return 0 if there is none or
+// the driver rejects it
+static u32 shaderCacheLoad(u64 key) {
+    if (!GLEW_ARB_get_program_binary) return 0;
+
+    String file{};
+    if (!file_read(shaderCachePath(key).c_str(), file)) return 0;
+
+    u32 program = 0;
+    if (file.length > 4) {
+        u32 format;
+        memcpy(&format, file.data, 4);
+
+        program = glCreateProgram();
+        glProgramBinary(program, format, file.data + 4, file.length - 4);
+
+        auto success = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+
+    free(file.data);
+    return program;
+}
+
+// Call before linking a program that is going to be stored in the cache
+static void shaderCacheHint(u32 program) {
+    if (!GLEW_ARB_get_program_binary) return;
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+static void shaderCacheStore(u32 program, u64 key) {
+    if (!GLEW_ARB_get_program_binary) return;
+
+    auto length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(program, length, NULL, &format, binary.data());
+
+    std::error_code ec;
+    std::filesystem::create_directories(SHADER_CACHE_DIRECTORY, ec);
+
+    auto path = shaderCachePath(key);
+    auto file = fopen(path.c_str(), "wb");
+    if (!file) {
+        fprintf(stderr, "Writing shader cache failed: '%s'\n", path.c_str());
+        return;
+    }
+
+    u32 format32 = format;
+    fwrite(&format32, 4, 1, file);
+    fwrite(binary.data(), 1, length, file);
+    fclose(file);
+}
+
+// Store the location of every active uniform. Arrays are stored both under
+// their base name and under the name of every element.
+static void shaderReflect(Shader& shader) {
+    shader.uniforms.clear();
+
+    auto count = 0, max_length = 0;
+    glGetProgramiv(shader.program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(shader.program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+    std::string name(max_length, '\0');
+    for (auto i = 0; i < count; i++) {
+        GLsizei length;
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(shader.program, i, max_length, &length, &size,
+                           &type, &name[0]);
+
+        std::string uniform(name.c_str(), length);
+        auto location = glGetUniformLocation(shader.program, uniform.c_str());
+        if (location < 0) continue; // Inside a uniform block
+
+        if (uniform.size() > 3 &&
+            uniform.compare(uniform.size() - 3, 3, "[0]") == 0) {
+            auto base = uniform.substr(0, uniform.size() - 3);
+            shader.uniforms[base] = location;
+            for (auto element = 1; element < size; element++) {
+                auto element_name = base + "[" + std::to_string(element) + "]";
+                shader.uniforms[element_name] =
+                    glGetUniformLocation(shader.program, element_name.c_str());
+            }
+        }
+        shader.uniforms[uniform] = location;
+    }
+}
+
+static double shaderSeconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+// Newest modification time of the sources of a shader
+static std::filesystem::file_time_type shaderModified(Shader& shader) {
+    std::error_code ec;
+    auto vertex   = std::filesystem::last_write_time(shader.vertex_path, ec);
+    auto fragment = std::filesystem::last_write_time(shader.fragment_path, ec);
+    return std::max(vertex, fragment);
+}
+
+static void shaderBuildDelete(ShaderBuild& build) {
+    if (build.program) glDeleteProgram(build.program);
+    if (build.vertex) glDeleteShader(build.vertex);
+    if (build.fragment) glDeleteShader(build.fragment);
+    build = {};
+}
+
+// Insert a header of defines and declarations after the #version line of a
+// source. The line numbers in error messages still match the file.
+static std::string shaderInject(const char* source,
+                                std::string const& header) {
+    std::string result = source;
+    if (header.empty()) return result;
+
+    auto version  = result.find("#version");
+    auto line_end = result.find('\n', version);
+    if (version == std::string::npos || line_end == std::string::npos) {
+        return header + "#line 1\n" + result;
+    }
+
+    result.insert(line_end + 1, header + "#line 2\n");
+    return result;
+}
+
+// Read the sources of the shader and hand them to the driver. Nothing waits
+// for the driver here, the result is picked up by shaderBuildPoll. Returns
+// false with the reason in shader.log if the sources could not be read.
+static bool shaderBuildStart(Shader& shader) {
+    if (shader.building) shaderBuildDelete(shader.build);
+    shader.building = false;
+    shader.modified = shaderModified(shader);
 
     String vertex_data{};
-    if (!file_read(vertex_path.c_str(), vertex_data)) {
-        error("Reading vertex file failed: %s", vertex_path.c_str());
+    if (!file_read(shader.vertex_path.c_str(), vertex_data)) {
+        shader.log = "Reading vertex file failed: " + shader.vertex_path;
         return false;
     }
 
     String fragment_data{};
-    if (!file_read(fragment_path.c_str(), fragment_data)) {
-        error("Reading fragment file failed: %s", fragment_path.c_str());
+    if (!file_read(shader.fragment_path.c_str(), fragment_data)) {
+        shader.log = "Reading fragment file failed: " + shader.fragment_path;
+        free(vertex_data.data);
         return false;
     }
 
-    auto success = 0;
-    char info_buffer[4096];
+    auto start  = std::chrono::steady_clock::now();
+    auto& build = shader.build;
+    build       = {};
 
-    // Vertex
-    auto vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vertex_data.data, NULL);
-    glCompileShader(vertex);
+    auto vertex_source   = shaderInject(vertex_data.data, shader.header);
+    auto fragment_source = shaderInject(fragment_data.data, shader.header);
+    free(vertex_data.data);
+    free(fragment_data.data);
 
-    // Check for compile errors
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(vertex, sizeof(info_buffer), NULL, info_buffer);
-        error("Compiling vertex-shader failed!\n\n%s", info_buffer);
-        return false;
+    const char* sources[] = {vertex_source.c_str(), fragment_source.c_str()};
+    build.key             = shaderCacheKey(sources, 2);
+    build.program         = shaderCacheLoad(build.key);
+    build.cached          = build.program != 0;
+
+    if (!build.cached) {
+        build.vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(build.vertex, 1, &sources[0], NULL);
+        glCompileShader(build.vertex);
+
+        build.fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(build.fragment, 1, &sources[1], NULL);
+        glCompileShader(build.fragment);
+
+        // Linking fails by itself if either stage failed to compile
+        build.program = glCreateProgram();
+        glAttachShader(build.program, build.vertex);
+        glAttachShader(build.program, build.fragment);
+        shaderCacheHint(build.program);
+        glLinkProgram(build.program);
     }
 
-    // Fragment
-    auto fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fragment_data.data, NULL);
-    glCompileShader(fragment);
+    build.time      = shaderSeconds(start);
+    shader.building = true;
+    return true;
+}
 
-    // Check for compile errors
-    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(fragment, sizeof(info_buffer), NULL, info_buffer);
-        error("Compiling fragment-shader failed!\n\n%s", info_buffer);
-        return false;
+// Check on a started build. Without wait a build the driver is still working
+// on is left pending, as far as GL_KHR_parallel_shader_compile can tell. A
+// finished program replaces the current one, a failed one leaves it in place
+// and its info logs in shader.log.
+static ShaderBuildStatus shaderBuildPoll(Shader& shader, bool wait) {
+    if (!shader.building) {
+        return shader.program ? SHADER_BUILD_DONE : SHADER_BUILD_FAILED;
     }
 
-    auto shader_program = glCreateProgram();
-    glAttachShader(shader_program, vertex);
-    glAttachShader(shader_program, fragment);
-    glLinkProgram(shader_program);
+    auto& build = shader.build;
+    if (!wait && !build.cached && GLEW_KHR_parallel_shader_compile) {
+        auto complete = 0;
+        glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &complete);
+        if (!complete) return SHADER_BUILD_PENDING;
+    }
 
-    // Check for link errors
-    glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+    auto start   = std::chrono::steady_clock::now();
+    auto success = 0;
+    glGetProgramiv(build.program, GL_LINK_STATUS, &success);
     if (!success) {
-        glGetProgramInfoLog(shader_program, sizeof(info_buffer), NULL,
-                            info_buffer);
-        error("Linking program failed!\n\n%s", info_buffer);
-        return false;
+        char info_buffer[4096];
+        shader.log.clear();
+
+        const std::pair<u32, const char*> stages[] = {
+            {build.vertex, "vertex-shader"},
+            {build.fragment, "fragment-shader"}};
+        for (auto& [stage, name] : stages) {
+            auto compiled = 0;
+            glGetShaderiv(stage, GL_COMPILE_STATUS, &compiled);
+            if (compiled) continue;
+
+            glGetShaderInfoLog(stage, sizeof(info_buffer), NULL, info_buffer);
+            shader.log += std::string("Compiling ") + name + " failed!\n\n" +
+                          info_buffer;
+        }
+        if (shader.log.empty()) {
+            glGetProgramInfoLog(build.program, sizeof(info_buffer), NULL,
+                                info_buffer);
+            shader.log = std::string("Linking program failed!\n\n") +
+                         info_buffer;
+        }
+
+        shaderBuildDelete(build);
+        shader.building = false;
+        return SHADER_BUILD_FAILED;
     }
 
-    shader.program  = shader_program;
-    shader.vertex   = vertex;
-    shader.fragment = fragment;
-    return true;
+    if (!build.cached) shaderCacheStore(build.program, build.key);
+
+    // Swap in the new program
+    if (shader.program) gl_state_delete_program(shader.program);
+    if (shader.vertex) glDeleteShader(shader.vertex);
+    if (shader.fragment) glDeleteShader(shader.fragment);
+    shader.program  = build.program;
+    shader.vertex   = build.vertex;
+    shader.fragment = build.fragment;
+    shader.building = false;
+    shader.log.clear();
+    shader.values.clear();
+    shader.generation++;
+
+    shaderReflect(shader);
+    for (auto& [name, binding] : shader.blocks) {
+        auto index = glGetUniformBlockIndex(shader.program, name.c_str());
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(shader.program, index, binding);
+    }
+
+    if (build.cached) {
+        shaderCacheStats.loaded++;
+    } else {
+        shaderCacheStats.compiled++;
+    }
+    shaderCacheStats.time += build.time + shaderSeconds(start);
+    build = {};
+    return SHADER_BUILD_DONE;
 }
 
-static bool shaderSetFloat(Shader& shader, std::string const& name,
-                           float value) {
-    auto location = glGetUniformLocation(shader.program, name.c_str());
-    if (location < 0) {
-        error("Shader uniform not found! '%s'\n", name.c_str());
+// Start building the shader again if its sources changed since the last build
+static bool shaderReloadIfChanged(Shader& shader) {
+    if (shader.building || shaderModified(shader) == shader.modified)
         return false;
+    return shaderBuildStart(shader);
+}
+
+// Let the driver compile on as many threads as it likes. Without
+// GL_KHR_parallel_shader_compile drivers may still compile in the background,
+// but there is no way to ask whether they are done.
+static void shaderInit() {
+    if (GLEW_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xffffffff);
+}
+
+// Hand the sources of a program to the driver without waiting for it, so that
+// several programs compile at once and other loading can go on meanwhile.
+// Finish with shaderCompileFinish.
+static void shaderCompileStart(Shader& shader, std::string const& vertex_path,
+                               std::string const& fragment_path,
+                               std::string const& header = "") {
+    shader.vertex_path   = vertex_path;
+    shader.fragment_path = fragment_path;
+    shader.header        = header;
+    if (!shaderBuildStart(shader)) error("%s\n", shader.log.c_str());
+}
+
+// Wait for started programs and stop on the first that failed. Programs that
+// are done are picked up first, so their results are not waited on behind
+// a slower one. Between checks the thread sleeps, leaving the core to the
+// driver's compiler threads.
+static void shaderCompileFinish(Shader* const* shaders, int count) {
+    for (auto pending = true; pending;) {
+        pending = false;
+        for (auto i = 0; i < count; i++) {
+            auto status = shaderBuildPoll(*shaders[i], false);
+            if (status == SHADER_BUILD_FAILED) {
+                error("%s\n", shaders[i]->log.c_str());
+            }
+            if (status == SHADER_BUILD_PENDING) pending = true;
+        }
+        if (pending) std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
+}
 
-    glUniform1f(location, value);
-    return true;
+// A uniform the compiler optimized away gets location -1, which GL ignores, so
+// that editing a shader at runtime cannot end the game. Uniforms that only
+// some variants of a shader use are not required.
+template <typename T>
+static ShaderUniform<T> shaderUniform(Shader& shader, std::string const& name,
+                                      bool required = true) {
+    auto uniform = shader.uniforms.find(name);
+    if (uniform == shader.uniforms.end()) {
+        if (required) {
+            fprintf(stderr, "Shader uniform not found! '%s'\n",
+                    name.c_str());
+        }
+        return {};
+    }
+
+    return {uniform->second};
 }
 
-static bool shaderSetFloat(Shader& shader, std::string const& name, int index,
-                           std::string const& member, float value) {
+template <typename T>
+static ShaderUniform<T> shaderUniform(Shader& shader, std::string const& name,
+                                      int index, std::string const& member) {
     char buffer[128];
     sprintf(buffer, "%s[%i].%s", name.c_str(), index, member.c_str());
-    return shaderSetFloat(shader, buffer, value);
+    return shaderUniform<T>(shader, buffer);
 }
 
-static bool shaderSetVec2(Shader& shader, std::string const& name,
-                          glm::vec2 const& value) {
-    auto location = glGetUniformLocation(shader.program, name.c_str());
-    if (location < 0) {
-        error("Shader uniform not found! '%s'\n", name.c_str());
-        return false;
+// Record a value about to be uploaded to a uniform of the shader. Returns
+// false when the uniform already has it and the upload can be skipped.
+template <typename T>
+static bool shaderChanged(Shader* shader, int location, T const& value) {
+    static_assert(sizeof(T) <= sizeof(ShaderUniformValue::data));
+    if (location < 0) return false;
+    if (!shader) {
+        shaderUniformStats.issued++;
+        return true;
     }
 
-    glUniform2fv(location, 1, glm::value_ptr(value));
-    return true;
-}
+    if (location >= (int)shader->values.size())
+        shader->values.resize(location + 1);
 
-static bool shaderSetVec3(Shader& shader, std::string const& name,
-                          glm::vec3 const& value) {
-    auto location = glGetUniformLocation(shader.program, name.c_str());
-    if (location < 0) {
-        error("Shader uniform not found! '%s'\n", name.c_str());
+    auto& shadow = shader->values[location];
+    if (shadow.size == sizeof(T) && !memcmp(shadow.data, &value, sizeof(T))) {
+        shaderUniformStats.suppressed++;
         return false;
     }
 
-    glUniform3fv(location, 1, glm::value_ptr(value));
+    shadow.size = sizeof(T);
+    memcpy(shadow.data, &value, sizeof(T));
+    shaderUniformStats.issued++;
     return true;
 }
 
-static bool shaderSetVec3(Shader& shader, std::string const& name, int index,
-                          std::string const& member, glm::vec3 const& value) {
-    char buffer[128];
-    sprintf(buffer, "%s[%i].%s", name.c_str(), index, member.c_str());
-    return shaderSetVec3(shader, buffer, value);
+// Keep the upload counts of the frame that ended and start counting the next
+static void shaderEndFrame() {
+    shaderUniformStatsLastFrame = shaderUniformStats;
+    shaderUniformStats          = {};
+}
+
+// Set a uniform of the bound shader through a handle
+static void shaderSet(ShaderUniform<int> uniform, int value) {
+    if (shaderChanged(shaderBound, uniform.location, value))
+        glUniform1i(uniform.location, value);
+}
+
+static void shaderSet(ShaderUniform<glm::vec4> uniform,
+                      glm::vec4 const& value) {
+    if (shaderChanged(shaderBound, uniform.location, value))
+        glUniform4fv(uniform.location, 1, glm::value_ptr(value));
+}
+
+static void shaderSet(ShaderUniform<glm::mat4> uniform,
+                      glm::mat4 const& value) {
+    if (shaderChanged(shaderBound, uniform.location, value)) {
+        glUniformMatrix4fv(uniform.location, 1, GL_FALSE,
+                           glm::value_ptr(value));
+    }
 }
 
-static bool shaderSetVec4(Shader& shader, std::string const& name,
-                          glm::vec4 const& value) {
-    auto location = glGetUniformLocation(shader.program, name.c_str());
-    if (location < 0) {
+// Location of a uniform for the setter by name, which stops the game if it
+// does not exist
+static int shaderLocation(Shader& shader, std::string const& name) {
+    auto uniform = shader.uniforms.find(name);
+    if (uniform == shader.uniforms.end()) {
         error("Shader uniform not found! '%s'\n", name.c_str());
-        return false;
+        return -1;
     }
 
-    glUniform4fv(location, 1, glm::value_ptr(value));
-    return true;
+    return uniform->second;
 }
 
 static bool shaderSetMat4(Shader& shader, std::string const& name,
                           glm::mat4 const& value) {
-    auto location = glGetUniformLocation(shader.program, name.c_str());
-    if (location < 0) {
-        error("Shader uniform not found! '%s'\n", name.c_str());
-        return false;
-    }
+    auto location = shaderLocation(shader, name);
+    if (location < 0) return false;
 
-    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    if (shaderChanged(&shader, location, value))
+        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
     return true;
 }
 
-static bool shaderSetTexture(Shader& shader, const std::string& name, int id) {
-    auto location = glGetUniformLocation(shader.program, name.c_str());
-    if (location < 0) {
-        error("Shader uniform not found! '%s'\n", name.c_str());
+// Remember the binding of a block for later builds, once per block name
+static void shaderBlockRecord(std::vector<std::pair<std::string, u32>>& blocks,
+                              std::string const& name, u32 binding) {
+    for (auto& block : blocks) {
+        if (block.first != name) continue;
+        block.second = binding;
+        return;
+    }
+    blocks.emplace_back(name, binding);
+}
+
+// Attach a uniform block of the shader to a binding point
+static bool shaderBindBlock(Shader& shader, std::string const& name,
+                            u32 binding) {
+    auto index = glGetUniformBlockIndex(shader.program, name.c_str());
+    if (index == GL_INVALID_INDEX) {
+        error("Shader uniform block not found! '%s'\n", name.c_str());
         return false;
     }
 
-    glUniform1i(location, id);
+    glUniformBlockBinding(shader.program, index, binding);
+    shaderBlockRecord(shader.blocks, name, binding);
     return true;
 }
 
+struct ShaderDefine {
+    const char* name;
+    int value;
+};
+
+// Variants of one shader built from different sets of #defines. A variant is
+// compiled the first time it is asked for and kept from then on.
+struct ShaderVariants {
+    std::string vertex_path;
+    std::string fragment_path;
+    std::string header; // Goes before the defines of every variant
+    std::vector<std::pair<std::string, u32>> blocks;
+    std::unordered_map<u64, std::unique_ptr<Shader>> variants;
+};
+
+static void shaderVariantsCreate(ShaderVariants& variants,
+                                 std::string const& vertex_path,
+                                 std::string const& fragment_path,
+                                 std::string const& header = "") {
+    variants.vertex_path   = vertex_path;
+    variants.fragment_path = fragment_path;
+    variants.header        = header;
+}
+
+// Attach a uniform block of every variant to a binding point
+static void shaderVariantsBindBlock(ShaderVariants& variants,
+                                    std::string const& name, u32 binding) {
+    shaderBlockRecord(variants.blocks, name, binding);
+    for (auto& [key, variant] : variants.variants) {
+        shaderBindBlock(*variant, name, binding);
+    }
+}
+
+// Find the variant for a set of defines, or start building it. A new variant
+// has no program until it is finished with shaderBuildPoll, a variant that
+// failed to build has none either, and its errors are in its log.
+static Shader* shaderVariant(ShaderVariants& variants,
+                             ShaderDefine const* defines, int count) {
+    u64 key = HASH_FNV1A_BASIS;
+    for (auto i = 0; i < count; i++) {
+        key = hash_fnv1a(defines[i].name, strlen(defines[i].name), key);
+        key = hash_fnv1a(&defines[i].value, sizeof(int), key);
+    }
+
+    auto& variant = variants.variants[key];
+    if (variant) return variant.get();
+
+    variant                = std::make_unique<Shader>();
+    variant->vertex_path   = variants.vertex_path;
+    variant->fragment_path = variants.fragment_path;
+    variant->blocks        = variants.blocks;
+    variant->header        = variants.header;
+    for (auto i = 0; i < count; i++) {
+        variant->header += std::string("#define ") + defines[i].name + " " +
+                           std::to_string(defines[i].value) + "\n";
+    }
+
+    shaderBuildStart(*variant);
+    return variant.get();
+}
+
 // Bind shader to OpenGL context
 static void shaderBind(Shader& shader) {
-    glUseProgram(shader.program);
+    gl_state_use_program(shader.program);
+    shaderBound = &shader;
 }
 
 #endif
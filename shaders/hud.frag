@@ -0,0 +1,10 @@
+#version 330 core
+in vec2 ourTexCoords;
+out vec4 color;
+
+// Premultiplied by alpha
+uniform sampler2D layer;
+
+void main() {
+    color = texture(layer, ourTexCoords);
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+#version 330 core
+out vec2 ourTexCoords;
+
+// One triangle covering the screen, without any vertex data
+void main() {
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    ourTexCoords  = position;
+    gl_Position   = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
\ No newline at end of file
@@ -1,52 +1,40 @@
 #version 330 core
 
-struct DirectionalLight {
-    vec3 direction;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct PointLight {
-    vec3 position;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
-
-struct Material {
-    vec3 diffuse;
-    vec3 specular;
-    float shininess;
-};
+// Features of this variant, see shaderVariant in shader.h. The defaults are
+// the most general variant.
+#ifndef POINT_LIGHT_COUNT
+#define POINT_LIGHT_COUNT 8 // Point lights in use, at most 8
+#endif
+#ifndef SPECULAR
+#define SPECULAR 1
+#endif
 
 in vec3 ourNormal;
 in vec3 FragPosition;
 in vec2 ourTexCoords;
 out vec4 FragColor;
 
-uniform Material material;
-uniform DirectionalLight dir_light;
-uniform PointLight point_light[8];
-uniform vec3 view_position;
+// The light structs and the Camera, Lights and Material blocks are declared
+// by the game, see the Std140Struct descriptions in main.cpp
+
 uniform sampler2D tex;
+uniform vec4 atlas_rect; // Offset and scale of the atlas entry
 
 vec3 dir_light_calculate(DirectionalLight light, vec3 color, vec3 normal,
                          vec3 view_dir) {
     vec3 light_dir = normalize(-light.direction);
     float diff     = max(dot(normal, light_dir), 0.0);
 
+    vec3 ambient = light.ambient * material.diffuse * color;
+    vec3 diffuse = light.diffuse * diff * material.diffuse * color;
+#if SPECULAR
     vec3 reflect_dir = reflect(-light_dir, normal);
     float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
-
-    vec3 ambient  = light.ambient * material.diffuse * color;
-    vec3 diffuse  = light.diffuse * diff * material.diffuse * color;
     vec3 specular = light.specular * spec * material.specular;
     return (ambient + diffuse + specular);
+#else
+    return (ambient + diffuse);
+#endif
 }
 
 vec3 point_light_calculate(PointLight light, vec3 color, vec3 normal,
@@ -54,31 +42,36 @@ vec3 point_light_calculate(PointLight light, vec3 color, vec3 normal,
     vec3 light_dir = -normalize(frag_position - light.position);
     float diff     = max(dot(normal, light_dir), 0.0);
 
-    vec3 reflect_dir = reflect(-light_dir, normal);
-    float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
-
     float distance    = length(light.position - frag_position);
     float denominator = (light.constant + light.linear * distance +
                          light.quadratic * (distance * distance));
     float attenuation = denominator == 0.0 ? 0.0 : (1.0 / denominator);
 
-    vec3 ambient  = light.ambient * material.diffuse * color;
-    vec3 diffuse  = light.diffuse * diff * material.diffuse * color;
+    vec3 ambient = light.ambient * material.diffuse * color;
+    vec3 diffuse = light.diffuse * diff * material.diffuse * color;
+#if SPECULAR
+    vec3 reflect_dir = reflect(-light_dir, normal);
+    float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
     vec3 specular = light.specular * spec * material.specular;
-    ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
-    return (ambient + diffuse + specular);
+    return (ambient + diffuse + specular) * attenuation;
+#else
+    return (ambient + diffuse) * attenuation;
+#endif
 }
 void main() {
     vec3 normal   = normalize(ourNormal);
     vec3 view_dir = normalize(view_position - FragPosition);
 
-    vec3 color = texture(tex, ourTexCoords).rgb;
+    // Repeat inside the atlas entry. The gradients of the unwrapped
+    // coordinates keep the mip level from jumping where the entry wraps.
+    vec2 uv    = atlas_rect.xy + fract(ourTexCoords) * atlas_rect.zw;
+    vec3 color = textureGrad(tex, uv, dFdx(ourTexCoords) * atlas_rect.zw,
+                             dFdy(ourTexCoords) * atlas_rect.zw)
+                     .rgb;
 
     vec3 result = dir_light_calculate(dir_light, color, normal, view_dir);
 
-    for (int i = 0; i < 8; i++) {
+    for (int i = 0; i < POINT_LIGHT_COUNT; i++) {
         result += point_light_calculate(point_light[i], color, normal, view_dir,
                                         FragPosition);
     }
@@ -3,8 +3,7 @@ layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
 
-uniform mat4 projection;
-uniform mat4 view;
+// The Camera block is declared by the game, see CameraBlock in main.cpp
 uniform mat4 model;
 
 out vec3 ourNormal;
@@ -1,51 +1,40 @@
 #version 330 core
 
-struct DirectionalLight {
-    vec3 direction;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct PointLight {
-    vec3 position;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
-
-struct Material {
-    vec3 diffuse;
-    vec3 specular;
-    float shininess;
-};
+// Features of this variant, see shaderVariant in shader.h. The defaults are
+// the most general variant.
+#ifndef POINT_LIGHT_COUNT
+#define POINT_LIGHT_COUNT 8 // Point lights in use, at most 8
+#endif
+#ifndef SPECULAR
+#define SPECULAR 1
+#endif
+#ifndef SPLAT_LAYERS
+#define SPLAT_LAYERS 4 // Texture layers blended by the splatmaps
+#endif
 
 in vec3 ourNormal;
 in vec3 FragPosition;
 in vec2 ourTexCoords;
 out vec4 FragColor;
 
-uniform Material material;
-uniform DirectionalLight dir_light;
-uniform PointLight point_light[8];
-uniform vec3 view_position;
+// The light structs and the Camera, Lights and Material blocks are declared
+// by the game, see the Std140Struct descriptions in main.cpp
 
 vec3 dir_light_calculate(DirectionalLight light, vec3 color, vec3 normal,
                          vec3 view_dir) {
     vec3 light_dir = normalize(-light.direction);
     float diff     = max(dot(normal, light_dir), 0.0);
 
+    vec3 ambient = light.ambient * material.diffuse * color;
+    vec3 diffuse = light.diffuse * diff * material.diffuse * color;
+#if SPECULAR
     vec3 reflect_dir = reflect(-light_dir, normal);
     float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
-
-    vec3 ambient  = light.ambient * material.diffuse * color;
-    vec3 diffuse  = light.diffuse * diff * material.diffuse * color;
     vec3 specular = light.specular * spec * material.specular;
     return (ambient + diffuse + specular);
+#else
+    return (ambient + diffuse);
+#endif
 }
 
 vec3 point_light_calculate(PointLight light, vec3 color, vec3 normal,
@@ -53,44 +42,49 @@ vec3 point_light_calculate(PointLight light, vec3 color, vec3 normal,
     vec3 light_dir = -normalize(frag_position - light.position);
     float diff     = max(dot(normal, light_dir), 0.0);
 
-    vec3 reflect_dir = reflect(-light_dir, normal);
-    float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
-
     float distance    = length(light.position - frag_position);
     float denominator = (light.constant + light.linear * distance +
                          light.quadratic * (distance * distance));
     float attenuation = denominator == 0.0 ? 0.0 : (1.0 / denominator);
 
-    vec3 ambient  = light.ambient * material.diffuse * color;
-    vec3 diffuse  = light.diffuse * diff * material.diffuse * color;
+    vec3 ambient = light.ambient * material.diffuse * color;
+    vec3 diffuse = light.diffuse * diff * material.diffuse * color;
+#if SPECULAR
+    vec3 reflect_dir = reflect(-light_dir, normal);
+    float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
     vec3 specular = light.specular * spec * material.specular;
-    ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
-    return (ambient + diffuse + specular);
+    return (ambient + diffuse + specular) * attenuation;
+#else
+    return (ambient + diffuse) * attenuation;
+#endif
 }
 
-uniform sampler2D textures[4];
-uniform sampler2D splatmap;
+uniform sampler2DArray layers;
+uniform sampler2DArray splatmaps;
 
 void main() {
     vec3 normal   = normalize(ourNormal);
     vec3 view_dir = normalize(view_position - FragPosition);
 
     vec2 splatmap_texcoords = ourTexCoords;
-    vec4 splatmap_color     = texture(splatmap, splatmap_texcoords);
-
-    vec2 texcoord = splatmap_texcoords * 10;
-
-    vec3 color = vec3(0);
-    color += texture(textures[0], texcoord).rgb * splatmap_color.r;
-    color += texture(textures[1], texcoord).rgb * splatmap_color.b;
-    color += texture(textures[2], texcoord).rgb * splatmap_color.g;
-    color += texture(textures[3], texcoord).rgb *
-             (1 - splatmap_color.r - splatmap_color.g - splatmap_color.b);
+    vec2 texcoord           = splatmap_texcoords * 10;
+
+    // Layer i is weighted by channel i % 4 of splatmap i / 4 and the last
+    // layer gets the remaining weight
+    vec3 color      = vec3(0);
+    vec4 weights    = vec4(0);
+    float remaining = 1.0;
+    for (int i = 0; i < SPLAT_LAYERS - 1; i++) {
+        if (i % 4 == 0) {
+            weights = texture(splatmaps, vec3(splatmap_texcoords, i / 4));
+        }
+        color += texture(layers, vec3(texcoord, i)).rgb * weights[i % 4];
+        remaining -= weights[i % 4];
+    }
+    color += texture(layers, vec3(texcoord, SPLAT_LAYERS - 1)).rgb * remaining;
 
     vec3 result = dir_light_calculate(dir_light, color, normal, view_dir);
-    for (int i = 0; i < 8; i++) {
+    for (int i = 0; i < POINT_LIGHT_COUNT; i++) {
         result += point_light_calculate(point_light[i], color, normal, view_dir,
                                         FragPosition);
     }
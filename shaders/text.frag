@@ -1,11 +1,15 @@
 #version 330 core
 in vec2 ourTexCoords;
+in vec4 ourColor;
 out vec4 color;
 
+// Signed distance to the glyph outline, 0.5 on the outline
 uniform sampler2D text;
-uniform vec3 textColor;
 
 void main() {
-    vec4 sampled = vec4(1.0, 1.0, 1.0, texture(text, ourTexCoords).r);
-    color        = vec4(textColor, 1.0) * sampled;
+    float distance = texture(text, ourTexCoords).r;
+    // Blend over about one pixel on screen, whatever size the text is drawn at
+    float width = fwidth(distance);
+    float alpha = smoothstep(0.5 - width, 0.5 + width, distance);
+    color       = vec4(ourColor.rgb, ourColor.a * alpha);
 }
\ No newline at end of file
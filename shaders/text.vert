@@ -1,11 +1,14 @@
 #version 330 core
 layout(location = 0) in vec4 vertex;
+layout(location = 1) in vec4 vertexColor;
 
 out vec2 ourTexCoords;
+out vec4 ourColor;
 
 uniform mat4 projection;
 
 void main() {
-    gl_Position = projection * vec4(vertex.xy, 0.0, 1.0);
-    ourTexCoords   = vertex.zw;
+    gl_Position  = projection * vec4(vertex.xy, 0.0, 1.0);
+    ourTexCoords = vertex.zw;
+    ourColor     = vertexColor;
 }
\ No newline at end of file
@@ -0,0 +1,145 @@
+#pragma once
+#if !defined(STD140_H)
+#define STD140_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+#include "type.h"
+
+// Describes C++ structs that are uploaded to uniform blocks as they are. The
+// fields of a struct are listed once, the offsets the compiler gave them are
+// checked against the std140 rules at compile time, and the GLSL declarations
+// of the struct are generated from the same list, so the C++ and GLSL sides
+// cannot drift apart:
+//
+//     template <> struct Std140Struct<Foo> {
+//         static constexpr const char* name = "Foo";
+//         static constexpr Std140Field fields[] = {
+//             STD140_FIELD(Foo, a),
+//             STD140_FIELD(Foo, b),
+//         };
+//     };
+//     static_assert(std140_check<Foo>(), "std140 Foo");
+
+struct Std140Field {
+    const char* name;
+    const char* type; // GLSL type of one element
+    u32 offset;       // Where the C++ compiler put the field
+    u32 alignment;    // std140 base alignment
+    u32 size;         // std140 size of one element, the stride in arrays
+    u32 count;        // Array length, 0 when the field is not an array
+};
+
+// Specialized for every struct used in a block, as above
+template <typename T>
+struct Std140Struct;
+
+constexpr u32 std140_align(u32 offset, u32 alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Where the last field of a struct ends in std140, or 0 if any field of the
+// C++ struct is somewhere else than std140 puts it
+template <typename T>
+constexpr u32 std140_end() {
+    u32 end = 0;
+    for (auto& field : Std140Struct<T>::fields) {
+        auto offset = std140_align(end, field.alignment);
+        if (field.offset != offset) return 0;
+        end = offset + field.size * (field.count ? field.count : 1);
+    }
+    return end;
+}
+
+// std140 alignment, size and GLSL name of a type. Structs are aligned to a
+// vec4 and padded to one at the end.
+template <typename T>
+struct Std140Type {
+    static constexpr u32 alignment    = 16;
+    static constexpr u32 size         = std140_align(std140_end<T>(), 16);
+    static constexpr const char* name = Std140Struct<T>::name;
+};
+
+#define STD140_TYPE(T, type_alignment, type_size, type_name)                   \
+    template <>                                                                \
+    struct Std140Type<T> {                                                     \
+        static constexpr u32 alignment    = type_alignment;                    \
+        static constexpr u32 size         = type_size;                         \
+        static constexpr const char* name = type_name;                         \
+    };
+
+STD140_TYPE(float, 4, 4, "float")
+STD140_TYPE(int, 4, 4, "int")
+STD140_TYPE(u32, 4, 4, "uint")
+STD140_TYPE(glm::vec2, 8, 8, "vec2")
+STD140_TYPE(glm::vec3, 16, 12, "vec3")
+STD140_TYPE(glm::vec4, 16, 16, "vec4")
+STD140_TYPE(glm::mat4, 16, 64, "mat4")
+
+// Array elements are aligned and padded to a vec4 in std140, so a C++ array
+// only matches if its elements already are
+template <typename T>
+constexpr Std140Field std140_field(const char* name, u64 offset) {
+    if constexpr (std::is_array_v<T>) {
+        using Element = std::remove_extent_t<T>;
+        constexpr auto stride = std140_align(Std140Type<Element>::size, 16);
+        static_assert(sizeof(Element) == stride,
+                      "std140 array elements have a 16 byte stride");
+
+        return {name,
+                Std140Type<Element>::name,
+                (u32)offset,
+                std140_align(Std140Type<Element>::alignment, 16),
+                stride,
+                (u32)std::extent_v<T>};
+    } else {
+        return {name, Std140Type<T>::name, (u32)offset,
+                Std140Type<T>::alignment, Std140Type<T>::size, 0};
+    }
+}
+
+#define STD140_FIELD(type, member)                                             \
+    std140_field<decltype(type::member)>(#member, offsetof(type, member))
+
+// Whether every field of the C++ struct is where std140 puts it, and the
+// struct is as large as std140 pads it
+template <typename T>
+constexpr bool std140_check() {
+    auto end = std140_end<T>();
+    return end && sizeof(T) == std140_align(end, 16);
+}
+
+template <typename T>
+static std::string std140_glsl_fields() {
+    std::string glsl;
+    for (auto& field : Std140Struct<T>::fields) {
+        glsl += std::string("    ") + field.type + " " + field.name;
+        if (field.count) glsl += "[" + std::to_string(field.count) + "]";
+        glsl += ";\n";
+    }
+    return glsl;
+}
+
+// GLSL declaration of a struct used inside blocks
+template <typename T>
+static std::string std140_glsl_struct() {
+    return std::string("struct ") + Std140Struct<T>::name + " {\n" +
+           std140_glsl_fields<T>() + "};\n";
+}
+
+// GLSL declaration of a uniform block named after the struct. With an
+// instance name its fields are only reachable through that name.
+template <typename T>
+static std::string std140_glsl_block(const char* instance = nullptr) {
+    std::string glsl = std::string("layout(std140) uniform ") +
+                       Std140Struct<T>::name + " {\n" +
+                       std140_glsl_fields<T>() + "}";
+    if (instance) glsl += std::string(" ") + instance;
+    return glsl + ";\n";
+}
+
+#endif
@@ -27,4 +27,47 @@ static bool file_read(const char* path, String& data) {
     return true;
 }
 
+#define UTF8_REPLACEMENT 0xfffd
+
+// Decode the UTF-8 sequence at *text and move past it. A malformed sequence
+// decodes to U+FFFD and is skipped one byte at a time.
+static u32 utf8_decode(const char** text, const char* end) {
+    auto bytes     = (const u8*)*text;
+    u32 code_point = bytes[0];
+    *text += 1;
+    if (code_point < 0x80) return code_point;
+
+    auto length  = 0;
+    u32 smallest = 0;
+    if ((code_point & 0xe0) == 0xc0) {
+        length     = 2;
+        smallest   = 0x80;
+        code_point = code_point & 0x1f;
+    } else if ((code_point & 0xf0) == 0xe0) {
+        length     = 3;
+        smallest   = 0x800;
+        code_point = code_point & 0x0f;
+    } else if ((code_point & 0xf8) == 0xf0) {
+        length     = 4;
+        smallest   = 0x10000;
+        code_point = code_point & 0x07;
+    } else {
+        return UTF8_REPLACEMENT;
+    }
+
+    if (end - (const char*)bytes < length) return UTF8_REPLACEMENT;
+    for (auto i = 1; i < length; i++) {
+        if ((bytes[i] & 0xc0) != 0x80) return UTF8_REPLACEMENT;
+        code_point = code_point << 6 | (bytes[i] & 0x3f);
+    }
+
+    // Overlong encodings, surrogates and values past Unicode
+    if (code_point < smallest || code_point > 0x10ffff ||
+        (code_point >= 0xd800 && code_point <= 0xdfff))
+        return UTF8_REPLACEMENT;
+
+    *text = (const char*)bytes + length;
+    return code_point;
+}
+
 #endif
@@ -2,6 +2,9 @@
 #if !defined(TEXTURE_H)
 #define TEXTURE_H
 
+#include "gl_state.h"
+#include "texture_cache.h"
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -10,12 +13,14 @@ struct Texture {
     int width;
     int height;
     unsigned int id;
+    unsigned int target{GL_TEXTURE_2D};
+    int layer_count{1};
 };
 
 static Texture texture_load(const char* filename) {
     unsigned int texture;
     glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, texture);
     // set the texture wrapping/filtering options (on the currently bound
     // texture object)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -33,9 +38,154 @@ static Texture texture_load(const char* filename) {
     return {data, width, height, texture};
 }
 
+// Upload a cooked image with all of its prebuilt mip levels
+static Texture texture_upload(TextureImage const* image) {
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    image->level_count - 1);
+
+    for (auto i = 0; i < image->level_count; i++) {
+        auto& level = image->levels[i];
+        auto pixels = &image->data[level.offset];
+        if (image->compressed) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, image->internal_format,
+                                   level.width, level.height, 0, level.size,
+                                   pixels);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, i, image->internal_format, level.width,
+                         level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        }
+    }
+
+    return {nullptr, image->width, image->height, texture};
+}
+
+// Load a batch of textures through the cook cache. The images are decoded in
+// parallel on the pool and the GL textures are then created in one pass.
+static void texture_load_batch(TextureLoad* loads, int count,
+                               ThreadPool* pool) {
+    texture_decode_batch(loads, count, pool);
+
+    for (auto i = 0; i < count; i++) {
+        auto& load = loads[i];
+        if (load.cook == TEXTURE_COOK_COMPRESSED &&
+            !GLEW_EXT_texture_compression_s3tc) {
+            *load.texture = texture_load(load.filename);
+            continue;
+        }
+
+        if (!load.loaded) {
+            error("Loading texture failed: '%s'\n", load.filename);
+        }
+
+        *load.texture = texture_upload(&load.image);
+        load.image.data.clear();
+        load.image.data.shrink_to_fit();
+    }
+}
+
+// Load equally sized images into the layers of one GL_TEXTURE_2D_ARRAY. A
+// layer may also be a power of two larger than the smallest one, its finer
+// levels are then skipped. All layers must cook to the same format.
+static Texture texture_array_load(const char* const* filenames, int count,
+                                  ThreadPool* pool,
+                                  TextureCook cook = TEXTURE_COOK_COMPRESSED) {
+    if (!GLEW_EXT_texture_compression_s3tc) cook = TEXTURE_COOK_RGBA8;
+
+    std::vector<TextureLoad> loads(count);
+    for (auto i = 0; i < count; i++) {
+        loads[i].filename = filenames[i];
+        loads[i].cook     = cook;
+    }
+    texture_decode_batch(loads.data(), count, pool);
+
+    auto width  = loads[0].image.width;
+    auto height = loads[0].image.height;
+    for (auto& load : loads) {
+        if (!load.loaded) {
+            error("Loading texture failed: '%s'\n", load.filename);
+        }
+        width  = std::min(width, load.image.width);
+        height = std::min(height, load.image.height);
+    }
+
+    // The level of every layer that matches the array size
+    std::vector<int> first_levels(count);
+    auto level_count = TEXTURE_MAX_LEVELS;
+    for (auto i = 0; i < count; i++) {
+        auto& image = loads[i].image;
+        auto level  = 0;
+        while (level < image.level_count &&
+               (image.levels[level].width != width ||
+                image.levels[level].height != height))
+            level++;
+
+        if (level == image.level_count) {
+            error("Texture array layer has the wrong size: '%s'\n",
+                  filenames[i]);
+        }
+        if (image.internal_format != loads[0].image.internal_format) {
+            error("Texture array layer has the wrong format: '%s'\n",
+                  filenames[i]);
+        }
+
+        first_levels[i] = level;
+        level_count     = std::min(level_count, image.level_count - level);
+    }
+
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    gl_state_bind_texture(0, GL_TEXTURE_2D_ARRAY, texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+
+    auto& first = loads[0].image;
+    for (auto level = 0; level < level_count; level++) {
+        auto& size = first.levels[first_levels[0] + level];
+        if (first.compressed) {
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level,
+                                   first.internal_format, size.width,
+                                   size.height, count, 0, size.size * count,
+                                   NULL);
+        } else {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.internal_format,
+                         size.width, size.height, count, 0, GL_RGBA,
+                         GL_UNSIGNED_BYTE, NULL);
+        }
+
+        for (auto layer = 0; layer < count; layer++) {
+            auto& image  = loads[layer].image;
+            auto& source = image.levels[first_levels[layer] + level];
+            auto pixels  = &image.data[source.offset];
+            if (first.compressed) {
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0,
+                                          layer, size.width, size.height, 1,
+                                          first.internal_format, source.size,
+                                          pixels);
+            } else {
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+                                size.width, size.height, 1, GL_RGBA,
+                                GL_UNSIGNED_BYTE, pixels);
+            }
+        }
+    }
+
+    return {nullptr, width, height, texture, GL_TEXTURE_2D_ARRAY, count};
+}
+
 static void texture_bind(Texture* texture, int index) {
-    glActiveTexture(GL_TEXTURE0 + index);
-    glBindTexture(GL_TEXTURE_2D, texture->id);
+    gl_state_bind_texture(index, texture->target, texture->id);
 }
 
 #endif
@@ -0,0 +1,258 @@
+#pragma once
+#if !defined(TEXTURE_ATLAS_H)
+#define TEXTURE_ATLAS_H
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+#include "rect_pack.h"
+#include "texture.h"
+
+// An atlas packs several repeating textures into one so that objects using
+// different ones can be drawn without rebinding. Every entry is resampled to a
+// power of two and surrounded by a wrapped copy of itself, so that bilinear
+// filtering and the box filtered mip levels never pick up a neighbour.
+// Entries start on multiples of TEXTURE_ATLAS_ALIGNMENT texels, which keeps
+// them on whole texels and compressed blocks down to the last atlas level, so
+// the same UV rectangle is correct for every level.
+
+#define TEXTURE_ATLAS_PADDING 32
+#define TEXTURE_ATLAS_LEVELS 6
+#define TEXTURE_ATLAS_ALIGNMENT (4 << (TEXTURE_ATLAS_LEVELS - 1))
+
+struct TextureAtlasEntry {
+    const char* filename;
+    int x;    // Position in the base level, without the padding
+    int y;
+    int size; // Width and height in the base level
+
+    glm::vec4 rect; // Texture coordinate offset in xy and scale in zw
+};
+
+struct TextureAtlas {
+    const char* name;
+    TextureCook cook;
+    std::vector<TextureAtlasEntry> entries;
+    int width;
+    int height;
+
+    Texture texture;
+};
+
+// The power of two closest to a texture size
+static int texture_atlas_entry_size(int size) {
+    auto power = 1 << (TEXTURE_ATLAS_LEVELS - 1);
+    while (power * 2 <= size) power *= 2;
+    if (size - power > 2 * power - size) power *= 2;
+    return power;
+}
+
+// Lay out the atlas from the sizes of its source images. Nothing is decoded
+// here, the pixels are built by texture_atlas_load.
+static void texture_atlas_create(TextureAtlas* atlas, const char* name,
+                                 const char* const* filenames, int count,
+                                 TextureCook cook = TEXTURE_COOK_COMPRESSED) {
+    if (!GLEW_EXT_texture_compression_s3tc) cook = TEXTURE_COOK_RGBA8;
+
+    atlas->name = name;
+    atlas->cook = cook;
+    atlas->entries.resize(count);
+
+    // Pack whole cells of TEXTURE_ATLAS_ALIGNMENT texels
+    std::vector<stbrp_rect> cells(count);
+    auto max_cells   = 0;
+    auto total_cells = 0;
+    for (auto i = 0; i < count; i++) {
+        int width, height, channels;
+        if (!stbi_info(filenames[i], &width, &height, &channels)) {
+            error("Loading texture failed: '%s'\n", filenames[i]);
+        }
+
+        auto& entry    = atlas->entries[i];
+        entry.filename = filenames[i];
+        entry.size     = texture_atlas_entry_size(std::max(width, height));
+
+        auto padded = entry.size + 2 * TEXTURE_ATLAS_PADDING;
+        auto units  = (padded + TEXTURE_ATLAS_ALIGNMENT - 1) /
+                     TEXTURE_ATLAS_ALIGNMENT;
+        cells[i].id = i;
+        cells[i].w  = units;
+        cells[i].h  = units;
+        max_cells   = std::max(max_cells, units);
+        total_cells += units;
+    }
+
+    // Try every width and keep the layout with the smallest area
+    std::vector<stbrp_rect> best;
+    auto best_width  = 0;
+    auto best_height = 0;
+    std::vector<stbrp_node> nodes(total_cells);
+    for (auto width = max_cells; width <= total_cells; width++) {
+        auto packed = cells;
+        stbrp_context context;
+        stbrp_init_target(&context, width, total_cells, nodes.data(), width);
+        if (!stbrp_pack_rects(&context, packed.data(), count)) continue;
+
+        auto used_width  = 0;
+        auto used_height = 0;
+        for (auto& cell : packed) {
+            used_width  = std::max(used_width, cell.x + cell.w);
+            used_height = std::max(used_height, cell.y + cell.h);
+        }
+
+        auto area = used_width * used_height;
+        if (best.empty() || area < best_width * best_height ||
+            (area == best_width * best_height &&
+             std::max(used_width, used_height) <
+                 std::max(best_width, best_height))) {
+            best        = packed;
+            best_width  = used_width;
+            best_height = used_height;
+        }
+    }
+
+    atlas->width  = best_width * TEXTURE_ATLAS_ALIGNMENT;
+    atlas->height = best_height * TEXTURE_ATLAS_ALIGNMENT;
+    for (auto& cell : best) {
+        auto& entry = atlas->entries[cell.id];
+        entry.x     = cell.x * TEXTURE_ATLAS_ALIGNMENT + TEXTURE_ATLAS_PADDING;
+        entry.y     = cell.y * TEXTURE_ATLAS_ALIGNMENT + TEXTURE_ATLAS_PADDING;
+        entry.rect  = {(float)entry.x / atlas->width,
+                       (float)entry.y / atlas->height,
+                       (float)entry.size / atlas->width,
+                       (float)entry.size / atlas->height};
+    }
+}
+
+// Bilinearly resample a float RGBA image to size x size, wrapping at the edges
+static void texture_atlas_resample(const float* src, int width, int height,
+                                   int size, float* dst) {
+    for (auto y = 0; y < size; y++) {
+        auto v  = (y + 0.5f) * height / size - 0.5f;
+        auto y0 = (int)floorf(v);
+        auto fy = v - y0;
+        auto r0 = ((y0 % height) + height) % height;
+        auto r1 = (r0 + 1) % height;
+        for (auto x = 0; x < size; x++) {
+            auto u  = (x + 0.5f) * width / size - 0.5f;
+            auto x0 = (int)floorf(u);
+            auto fx = u - x0;
+            auto c0 = ((x0 % width) + width) % width;
+            auto c1 = (c0 + 1) % width;
+            for (auto c = 0; c < 4; c++) {
+                auto top    = src[4 * (c0 + r0 * width) + c] * (1 - fx) +
+                              src[4 * (c1 + r0 * width) + c] * fx;
+                auto bottom = src[4 * (c0 + r1 * width) + c] * (1 - fx) +
+                              src[4 * (c1 + r1 * width) + c] * fx;
+                dst[4 * (x + y * size) + c] = top * (1 - fy) + bottom * fy;
+            }
+        }
+    }
+}
+
+// Decode the sources and build the atlas levels
+static bool texture_atlas_cook(TextureAtlas const* atlas,
+                               TextureImage* image) {
+    auto width  = atlas->width;
+    auto height = atlas->height;
+    std::vector<float> level(4 * (u64)width * height, 0.0f);
+    std::vector<float> resampled;
+
+    auto opaque = true;
+    for (auto& entry : atlas->entries) {
+        int source_width, source_height, channels;
+        auto pixels = stbi_loadf(entry.filename, &source_width, &source_height,
+                                 &channels, 4);
+        if (!pixels) return false;
+
+        resampled.resize(4 * entry.size * entry.size);
+        texture_atlas_resample(pixels, source_width, source_height, entry.size,
+                               resampled.data());
+        stbi_image_free(pixels);
+
+        // Fill the whole cell, the texels around the entry wrap around
+        auto cell_x    = entry.x - TEXTURE_ATLAS_PADDING;
+        auto cell_y    = entry.y - TEXTURE_ATLAS_PADDING;
+        auto cell_size = (entry.size + 2 * TEXTURE_ATLAS_PADDING +
+                          TEXTURE_ATLAS_ALIGNMENT - 1) /
+                         TEXTURE_ATLAS_ALIGNMENT * TEXTURE_ATLAS_ALIGNMENT;
+        for (auto y = 0; y < cell_size; y++) {
+            auto source_y = (y - TEXTURE_ATLAS_PADDING + entry.size) %
+                            entry.size;
+            for (auto x = 0; x < cell_size; x++) {
+                auto source_x = (x - TEXTURE_ATLAS_PADDING + entry.size) %
+                                entry.size;
+                auto src = &resampled[4 * (source_x + source_y * entry.size)];
+                auto dst = &level[4 * ((u64)(cell_x + x) +
+                                       (u64)(cell_y + y) * width)];
+                memcpy(dst, src, 4 * sizeof(float));
+                if (src[3] < 1.0f) opaque = false;
+            }
+        }
+    }
+
+    image->width       = width;
+    image->height      = height;
+    image->level_count = 0;
+    image->data.clear();
+    if (atlas->cook == TEXTURE_COOK_RGBA8) {
+        image->internal_format = GL_RGBA8;
+        image->base_format     = GL_RGBA;
+        image->compressed      = false;
+    } else if (opaque) {
+        image->internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        image->base_format     = GL_RGB;
+        image->compressed      = true;
+    } else {
+        image->internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        image->base_format     = GL_RGBA;
+        image->compressed      = true;
+    }
+
+    // Every level is an exact halving, so the whole atlas can be filtered at
+    // once without mixing entries.
+    std::vector<float> next;
+    for (auto i = 0; i < TEXTURE_ATLAS_LEVELS; i++) {
+        if (i > 0) {
+            next.resize(4 * (u64)(width / 2) * (height / 2));
+            texture_downsample(level.data(), width, height, next.data());
+            std::swap(level, next);
+            width /= 2;
+            height /= 2;
+        }
+        texture_encode_level(level.data(), width, height, image);
+    }
+
+    return true;
+}
+
+// Load the atlas levels from cache/atlas/, building and caching them first if
+// the cache is missing or any of the sources changed. Safe to call from the
+// pool.
+static bool texture_atlas_load(TextureAtlas const* atlas,
+                               TextureImage* image) {
+    u64 hash = HASH_FNV1A_BASIS;
+    for (auto& entry : atlas->entries) {
+        String source{};
+        if (!file_read(entry.filename, source)) return false;
+        hash = hash_fnv1a(source.data, source.length, hash);
+        free(source.data);
+
+        int layout[3] = {entry.x, entry.y, entry.size};
+        hash          = hash_fnv1a(layout, sizeof(layout), hash);
+    }
+
+    auto name = std::string("atlas/") + atlas->name;
+    auto path = texture_cache_path(name.c_str(), atlas->cook);
+    if (texture_cache_read(path.c_str(), hash, image)) return true;
+
+    if (!texture_atlas_cook(atlas, image)) return false;
+    if (!texture_cache_write(path.c_str(), image, hash)) {
+        fprintf(stderr, "Writing texture cache failed: '%s'\n", path.c_str());
+    }
+    return true;
+}
+
+#endif
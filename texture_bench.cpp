@@ -0,0 +1,97 @@
+// Startup texture loading benchmark. Loads the textures that init() loads, on
+// pools of increasing size, and prints the speedup over a single worker.
+//
+// cold: decode and cook every image, as on a first launch
+// warm: read the cooked images back from cache/, as on every later launch
+
+#include <chrono>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "texture_cache.h"
+
+static const char* bench_textures[] = {
+    "textures/terrain_splatmap.png",   "textures/terrain_texture_01.png",
+    "textures/terrain_texture_02.jpg", "textures/grass.png",
+    "textures/grass2.png",             "textures/SkyBox512.png",
+    "textures/fur_texture.jpg",        "textures/gold_texture.jpg",
+    "textures/rock_texture.jpg",       "textures/light_rock_texture.jpg",
+};
+
+#define BENCH_TEXTURE_COUNT                                                    \
+    (int)(sizeof(bench_textures) / sizeof(bench_textures[0]))
+#define BENCH_RUNS 3
+
+static double bench_run(int thread_count, bool warm) {
+    ThreadPool pool;
+    thread_pool_create(&pool, thread_count);
+
+    auto best = 1e30;
+    for (auto run = 0; run < BENCH_RUNS; run++) {
+        TextureLoad loads[BENCH_TEXTURE_COUNT];
+        for (auto i = 0; i < BENCH_TEXTURE_COUNT; i++) {
+            loads[i].filename = bench_textures[i];
+            loads[i].texture  = nullptr;
+            loads[i].cook     = i == 0 ? TEXTURE_COOK_RGBA8
+                                       : TEXTURE_COOK_COMPRESSED;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if (warm) {
+            texture_decode_batch(loads, BENCH_TEXTURE_COUNT, &pool);
+        } else {
+            for (auto& load : loads) {
+                auto l = &load;
+                thread_pool_submit(&pool, [l] {
+                    l->loaded = texture_cook(l->filename, l->cook, &l->image);
+                });
+            }
+            thread_pool_wait(&pool);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        for (auto& load : loads) {
+            if (!load.loaded) {
+                error("Loading texture failed: '%s'\n", load.filename);
+            }
+        }
+
+        std::chrono::duration<double, std::milli> elapsed = end - start;
+        best = std::min(best, elapsed.count());
+    }
+
+    thread_pool_destroy(&pool);
+    return best;
+}
+
+// Usage: ./texture_bench [max threads], defaults to one thread per core.
+// Rows with more threads than the machine has cores only show the cost of
+// the extra threads, the speedup has to be measured on a machine with more.
+int main(int argc, char** argv) {
+    // Make sure the cache is filled before measuring warm starts
+    bench_run(0, true);
+
+    int cores       = std::max(1, (int)std::thread::hardware_concurrency());
+    int max_threads = cores;
+    if (argc > 1) max_threads = std::max(1, atoi(argv[1]));
+    std::vector<int> thread_counts;
+    for (auto count = 1; count < max_threads; count *= 2)
+        thread_counts.push_back(count);
+    thread_counts.push_back(max_threads);
+
+    printf("%d textures, best of %d runs, up to %d threads on %d cores\n\n",
+           BENCH_TEXTURE_COUNT, BENCH_RUNS, max_threads, cores);
+    printf("threads   cold ms  speedup   warm ms  speedup\n");
+
+    double cold_base = 0, warm_base = 0;
+    for (auto count : thread_counts) {
+        auto cold = bench_run(count, false);
+        auto warm = bench_run(count, true);
+        if (count == 1) cold_base = cold, warm_base = warm;
+
+        printf("%7d  %8.1f  %6.2fx  %8.1f  %6.2fx%s\n", count, cold,
+               cold_base / cold, warm, warm_base / warm,
+               count > cores ? "  (more threads than cores)" : "");
+    }
+
+    return 0;
+}
@@ -0,0 +1,598 @@
+#pragma once
+#if !defined(TEXTURE_CACHE_H)
+#define TEXTURE_CACHE_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "error.h"
+#include "hash.h"
+#include "stb_image.h"
+#include "string.h"
+#include "thread_pool.h"
+#include "type.h"
+
+// Cooked textures are stored as KTX 1.1 files under cache/, one per source
+// image, holding a CPU-filtered mip chain that is uploaded as-is. The FNV-1a
+// hash of the source file is stored in the key/value data and a cooked file is
+// only used while it still matches the source.
+
+#define TEXTURE_CACHE_DIRECTORY "cache/"
+#define TEXTURE_CACHE_VERSION 1
+#define TEXTURE_MAX_LEVELS 16
+
+enum TextureCook {
+    TEXTURE_COOK_COMPRESSED, // BC1 for opaque images, BC3 otherwise
+    TEXTURE_COOK_RGBA8,      // Uncompressed, for data such as splatmaps
+};
+
+struct TextureImage {
+    u32 internal_format;
+    u32 base_format;
+    bool compressed;
+    int width;
+    int height;
+
+    struct Level {
+        int width;
+        int height;
+        u64 offset;
+        u64 size;
+    };
+
+    int level_count;
+    Level levels[TEXTURE_MAX_LEVELS];
+    std::vector<u8> data;
+};
+
+static std::string texture_cache_path(const char* filename,
+                                      TextureCook cook) {
+    std::string path = TEXTURE_CACHE_DIRECTORY;
+    path += filename;
+    path += cook == TEXTURE_COOK_RGBA8 ? ".rgba8.ktx" : ".bc.ktx";
+    return path;
+}
+
+static u8 texture_quantize(float value) {
+    return (u8)(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+// Halve a float RGBA image with a box filter, GL style: odd sizes round down.
+static void texture_downsample(const float* src, int width, int height,
+                               float* dst) {
+    auto dst_width  = std::max(width / 2, 1);
+    auto dst_height = std::max(height / 2, 1);
+    for (auto y = 0; y < dst_height; y++) {
+        for (auto x = 0; x < dst_width; x++) {
+            auto x0 = std::min(2 * x, width - 1);
+            auto x1 = std::min(2 * x + 1, width - 1);
+            auto y0 = std::min(2 * y, height - 1);
+            auto y1 = std::min(2 * y + 1, height - 1);
+            for (auto c = 0; c < 4; c++) {
+                dst[4 * (x + y * dst_width) + c] =
+                    0.25f * (src[4 * (x0 + y0 * width) + c] +
+                             src[4 * (x1 + y0 * width) + c] +
+                             src[4 * (x0 + y1 * width) + c] +
+                             src[4 * (x1 + y1 * width) + c]);
+            }
+        }
+    }
+}
+
+static u32 texture_pack565(const float* color) {
+    auto r = (u32)(std::clamp(color[0], 0.0f, 255.0f) * 31.0f / 255.0f + .5f);
+    auto g = (u32)(std::clamp(color[1], 0.0f, 255.0f) * 63.0f / 255.0f + .5f);
+    auto b = (u32)(std::clamp(color[2], 0.0f, 255.0f) * 31.0f / 255.0f + .5f);
+    return (r << 11) | (g << 5) | b;
+}
+
+static void texture_unpack565(u32 packed, float* color) {
+    auto r   = (packed >> 11) & 31;
+    auto g   = (packed >> 5) & 63;
+    auto b   = packed & 31;
+    color[0] = (float)((r << 3) | (r >> 2));
+    color[1] = (float)((g << 2) | (g >> 4));
+    color[2] = (float)((b << 3) | (b >> 2));
+}
+
+// Pick the closest palette entry for every pixel of a BC1 block in four-color
+// mode, returning the squared error of the block.
+static float texture_bc1_indices(const u8 pixels[16][4], u32 color0,
+                                 u32 color1, u32* indices) {
+    *indices = 0;
+    if (color0 == color1) {
+        float color[3];
+        texture_unpack565(color0, color);
+
+        auto error = 0.0f;
+        for (auto i = 0; i < 16; i++)
+            for (auto c = 0; c < 3; c++)
+                error += (pixels[i][c] - color[c]) * (pixels[i][c] - color[c]);
+        return error;
+    }
+
+    float palette[4][3];
+    texture_unpack565(color0, palette[0]);
+    texture_unpack565(color1, palette[1]);
+    for (auto c = 0; c < 3; c++) {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+
+    auto total = 0.0f;
+    for (auto i = 0; i < 16; i++) {
+        auto best       = 0;
+        auto best_error = 1e30f;
+        for (auto p = 0; p < 4; p++) {
+            auto dr    = pixels[i][0] - palette[p][0];
+            auto dg    = pixels[i][1] - palette[p][1];
+            auto db    = pixels[i][2] - palette[p][2];
+            auto error = dr * dr + dg * dg + db * db;
+            if (error < best_error) best_error = error, best = p;
+        }
+        *indices |= (u32)best << (2 * i);
+        total += best_error;
+    }
+    return total;
+}
+
+// Encode the colors of a 4x4 block as a BC1 block in four-color mode. The
+// endpoints start at the extremes of the block along its principal axis and
+// are then refined once with a least-squares fit to the chosen indices.
+static void texture_bc1_block(const u8 pixels[16][4], u8* out) {
+    float mean[3] = {};
+    for (auto i = 0; i < 16; i++)
+        for (auto c = 0; c < 3; c++) mean[c] += pixels[i][c] / 16.0f;
+
+    float cov[6] = {};
+    for (auto i = 0; i < 16; i++) {
+        auto r = pixels[i][0] - mean[0];
+        auto g = pixels[i][1] - mean[1];
+        auto b = pixels[i][2] - mean[2];
+        cov[0] += r * r;
+        cov[1] += r * g;
+        cov[2] += r * b;
+        cov[3] += g * g;
+        cov[4] += g * b;
+        cov[5] += b * b;
+    }
+
+    float axis[3] = {1.0f, 1.0f, 1.0f};
+    for (auto iteration = 0; iteration < 8; iteration++) {
+        float next[3] = {
+            cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+            cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+            cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+        auto length =
+            std::max({fabsf(next[0]), fabsf(next[1]), fabsf(next[2])});
+        if (length < 1e-6f) break;
+        for (auto c = 0; c < 3; c++) axis[c] = next[c] / length;
+    }
+
+    auto min_index = 0, max_index = 0;
+    auto min_dot = 1e30f, max_dot = -1e30f;
+    for (auto i = 0; i < 16; i++) {
+        auto dot = pixels[i][0] * axis[0] + pixels[i][1] * axis[1] +
+                   pixels[i][2] * axis[2];
+        if (dot < min_dot) min_dot = dot, min_index = i;
+        if (dot > max_dot) max_dot = dot, max_index = i;
+    }
+
+    float endpoint0[3], endpoint1[3];
+    for (auto c = 0; c < 3; c++) {
+        endpoint0[c] = pixels[max_index][c];
+        endpoint1[c] = pixels[min_index][c];
+    }
+
+    auto color0 = texture_pack565(endpoint0);
+    auto color1 = texture_pack565(endpoint1);
+    if (color0 < color1) std::swap(color0, color1);
+
+    u32 indices;
+    auto error = texture_bc1_indices(pixels, color0, color1, &indices);
+
+    if (color0 != color1) {
+        // Weights of color0 for the palette entries of four-color mode
+        const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+
+        float aa = 0, ab = 0, bb = 0;
+        float ax[3] = {}, bx[3] = {};
+        for (auto i = 0; i < 16; i++) {
+            auto a = weights[(indices >> (2 * i)) & 3];
+            auto b = 1.0f - a;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (auto c = 0; c < 3; c++) {
+                ax[c] += a * pixels[i][c];
+                bx[c] += b * pixels[i][c];
+            }
+        }
+
+        auto determinant = aa * bb - ab * ab;
+        if (fabsf(determinant) > 1e-6f) {
+            for (auto c = 0; c < 3; c++) {
+                endpoint0[c] = (bb * ax[c] - ab * bx[c]) / determinant;
+                endpoint1[c] = (aa * bx[c] - ab * ax[c]) / determinant;
+            }
+
+            auto refined0 = texture_pack565(endpoint0);
+            auto refined1 = texture_pack565(endpoint1);
+            if (refined0 < refined1) std::swap(refined0, refined1);
+
+            u32 refined_indices;
+            auto refined_error = texture_bc1_indices(
+                pixels, refined0, refined1, &refined_indices);
+            if (refined_error < error) {
+                color0  = refined0;
+                color1  = refined1;
+                indices = refined_indices;
+            }
+        }
+    }
+
+    out[0] = color0 & 0xff;
+    out[1] = color0 >> 8;
+    out[2] = color1 & 0xff;
+    out[3] = color1 >> 8;
+    out[4] = indices & 0xff;
+    out[5] = (indices >> 8) & 0xff;
+    out[6] = (indices >> 16) & 0xff;
+    out[7] = indices >> 24;
+}
+
+// Encode the alpha of a 4x4 block as a BC3 alpha block in eight-value mode.
+static void texture_bc3_alpha_block(const u8 pixels[16][4], u8* out) {
+    u8 alpha0 = 0, alpha1 = 255;
+    for (auto i = 0; i < 16; i++) {
+        alpha0 = std::max(alpha0, pixels[i][3]);
+        alpha1 = std::min(alpha1, pixels[i][3]);
+    }
+
+    u64 indices = 0;
+    if (alpha0 != alpha1) {
+        float palette[8] = {(float)alpha0, (float)alpha1};
+        for (auto p = 1; p < 7; p++)
+            palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7.0f;
+
+        for (auto i = 0; i < 16; i++) {
+            auto best = 0;
+            auto best_error = 1e30f;
+            for (auto p = 0; p < 8; p++) {
+                auto error = fabsf(pixels[i][3] - palette[p]);
+                if (error < best_error) best_error = error, best = p;
+            }
+            indices |= (u64)best << (3 * i);
+        }
+    }
+
+    out[0] = alpha0;
+    out[1] = alpha1;
+    for (auto i = 0; i < 6; i++) out[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+// Bytes a level of the image's format takes, 0 if the format is not one this
+// cache writes
+static u64 texture_level_size(TextureImage const* image, int width,
+                              int height) {
+    u64 blocks = (u64)((width + 3) / 4) * ((height + 3) / 4);
+    switch (image->internal_format) {
+    case GL_RGBA8: return (u64)width * height * 4;
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return blocks * 8;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return blocks * 16;
+    default: return 0;
+    }
+}
+
+static void texture_encode_level(const float* pixels, int width, int height,
+                                 TextureImage* image) {
+    auto& level  = image->levels[image->level_count++];
+    level.width  = width;
+    level.height = height;
+    level.offset = image->data.size();
+
+    level.size   = texture_level_size(image, width, height);
+
+    if (!image->compressed) {
+        image->data.resize(level.offset + level.size);
+        for (u64 i = 0; i < level.size; i++)
+            image->data[level.offset + i] = texture_quantize(pixels[i]);
+        return;
+    }
+
+    auto bc3 = image->internal_format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    auto blocks_wide = (width + 3) / 4;
+    auto blocks_high = (height + 3) / 4;
+    image->data.resize(level.offset + level.size);
+
+    auto out = &image->data[level.offset];
+    for (auto by = 0; by < blocks_high; by++) {
+        for (auto bx = 0; bx < blocks_wide; bx++) {
+            u8 block[16][4];
+            for (auto i = 0; i < 16; i++) {
+                // Partial blocks repeat the last row and column
+                auto x = std::min(4 * bx + i % 4, width - 1);
+                auto y = std::min(4 * by + i / 4, height - 1);
+                for (auto c = 0; c < 4; c++)
+                    block[i][c] =
+                        texture_quantize(pixels[4 * (x + y * width) + c]);
+            }
+
+            if (bc3) {
+                texture_bc3_alpha_block(block, out);
+                out += 8;
+            }
+            texture_bc1_block(block, out);
+            out += 8;
+        }
+    }
+}
+
+// Decode a source image and build its full mip chain. The image is decoded
+// with stbi_loadf, the same way texture_load does, so cooked textures keep the
+// look of the uncooked ones.
+static bool texture_cook(const char* filename, TextureCook cook,
+                         TextureImage* image) {
+    int width, height, channels;
+    auto pixels = stbi_loadf(filename, &width, &height, &channels, 4);
+    if (!pixels) return false;
+
+    auto opaque = true;
+    for (auto i = 0; i < width * height; i++)
+        if (pixels[4 * i + 3] < 1.0f) opaque = false;
+
+    image->width       = width;
+    image->height      = height;
+    image->level_count = 0;
+    image->data.clear();
+    if (cook == TEXTURE_COOK_RGBA8) {
+        image->internal_format = GL_RGBA8;
+        image->base_format     = GL_RGBA;
+        image->compressed      = false;
+    } else if (opaque) {
+        image->internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        image->base_format     = GL_RGB;
+        image->compressed      = true;
+    } else {
+        image->internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        image->base_format     = GL_RGBA;
+        image->compressed      = true;
+    }
+
+    std::vector<float> level(pixels, pixels + 4 * width * height);
+    std::vector<float> next;
+    stbi_image_free(pixels);
+
+    while (true) {
+        texture_encode_level(level.data(), width, height, image);
+        if ((width == 1 && height == 1) ||
+            image->level_count == TEXTURE_MAX_LEVELS)
+            break;
+
+        next.resize(4 * std::max(width / 2, 1) * std::max(height / 2, 1));
+        texture_downsample(level.data(), width, height, next.data());
+        std::swap(level, next);
+        width  = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+
+    return true;
+}
+
+static const u8 texture_ktx_identifier[12] = {0xAB, 'K',  'T',  'X',
+                                              ' ',  '1',  '1',  0xBB,
+                                              '\r', '\n', 0x1A, '\n'};
+
+struct TextureKtxHeader {
+    u8 identifier[12];
+    u32 endianness;
+    u32 gl_type;
+    u32 gl_type_size;
+    u32 gl_format;
+    u32 gl_internal_format;
+    u32 gl_base_internal_format;
+    u32 pixel_width;
+    u32 pixel_height;
+    u32 pixel_depth;
+    u32 array_elements;
+    u32 faces;
+    u32 mipmap_levels;
+    u32 key_value_bytes;
+};
+
+#define TEXTURE_KTX_HASH_KEY "tsbk07.source_hash"
+
+static bool texture_cache_write(const char* path, TextureImage const* image,
+                                u64 source_hash) {
+    std::error_code ec;
+    std::filesystem::create_directories(
+        std::filesystem::path(path).parent_path(), ec);
+
+    auto file = fopen(path, "wb");
+    if (!file) return false;
+
+    char value[32];
+    snprintf(value, sizeof(value), "%016llx",
+             (unsigned long long)(source_hash ^ TEXTURE_CACHE_VERSION));
+    auto key_value_size =
+        (u32)(sizeof(TEXTURE_KTX_HASH_KEY) + strlen(value) + 1);
+    auto padding        = (4 - key_value_size % 4) % 4;
+
+    TextureKtxHeader header{};
+    memcpy(header.identifier, texture_ktx_identifier, 12);
+    header.endianness              = 0x04030201;
+    header.gl_type                 = image->compressed ? 0 : GL_UNSIGNED_BYTE;
+    header.gl_type_size            = 1;
+    header.gl_format               = image->compressed ? 0 : GL_RGBA;
+    header.gl_internal_format      = image->internal_format;
+    header.gl_base_internal_format = image->base_format;
+    header.pixel_width             = image->width;
+    header.pixel_height            = image->height;
+    header.faces                   = 1;
+    header.mipmap_levels           = image->level_count;
+    header.key_value_bytes         = 4 + key_value_size + padding;
+    fwrite(&header, sizeof(header), 1, file);
+
+    u32 zero = 0;
+    fwrite(&key_value_size, 4, 1, file);
+    fwrite(TEXTURE_KTX_HASH_KEY, sizeof(TEXTURE_KTX_HASH_KEY), 1, file);
+    fwrite(value, strlen(value) + 1, 1, file);
+    fwrite(&zero, 1, padding, file);
+
+    // Every level is a multiple of 4 bytes, so no mip padding is needed
+    for (auto i = 0; i < image->level_count; i++) {
+        auto size = (u32)image->levels[i].size;
+        fwrite(&size, 4, 1, file);
+        fwrite(&image->data[image->levels[i].offset], 1, size, file);
+    }
+
+    fclose(file);
+    return true;
+}
+
+static bool texture_cache_read(const char* path, u64 source_hash,
+                               TextureImage* image) {
+    String file{};
+    if (!file_read(path, file)) return false;
+
+    auto valid  = false;
+    auto cursor = (u8*)file.data;
+    auto end    = cursor + file.length;
+    TextureKtxHeader header;
+
+    if (file.length >= (s64)sizeof(header)) {
+        memcpy(&header, cursor, sizeof(header));
+        cursor += sizeof(header);
+        valid = memcmp(header.identifier, texture_ktx_identifier, 12) == 0 &&
+                header.endianness == 0x04030201 &&
+                header.mipmap_levels > 0 &&
+                header.mipmap_levels <= TEXTURE_MAX_LEVELS &&
+                header.pixel_width - 1 < 1u << (TEXTURE_MAX_LEVELS - 1) &&
+                header.pixel_height - 1 < 1u << (TEXTURE_MAX_LEVELS - 1) &&
+                header.key_value_bytes <= (u64)(end - cursor);
+    }
+
+    if (valid) {
+        // Find the source hash among the key/value pairs
+        char expected[32];
+        snprintf(expected, sizeof(expected), "%016llx",
+                 (unsigned long long)(source_hash ^ TEXTURE_CACHE_VERSION));
+
+        auto matched = false;
+        auto kv      = cursor;
+        auto kv_end  = cursor + header.key_value_bytes;
+        while (kv + 4 <= kv_end) {
+            u32 size;
+            memcpy(&size, kv, 4);
+            kv += 4;
+            if (size > (u64)(kv_end - kv)) break;
+
+            // Only a pair exactly as long as the key and the expected value
+            // with their terminators can match, so neither is read past
+            auto value_bytes = strlen(expected) + 1;
+            if (size == sizeof(TEXTURE_KTX_HASH_KEY) + value_bytes &&
+                memcmp(kv, TEXTURE_KTX_HASH_KEY,
+                       sizeof(TEXTURE_KTX_HASH_KEY)) == 0) {
+                auto value = kv + sizeof(TEXTURE_KTX_HASH_KEY);
+                matched    = memcmp(value, expected, value_bytes) == 0;
+            }
+            kv += size + (4 - size % 4) % 4;
+        }
+
+        valid  = matched;
+        cursor = kv_end;
+    }
+
+    if (valid) {
+        image->internal_format = header.gl_internal_format;
+        image->base_format     = header.gl_base_internal_format;
+        image->compressed      = header.gl_type == 0;
+        image->width           = header.pixel_width;
+        image->height          = header.pixel_height;
+        image->level_count     = header.mipmap_levels;
+        image->data.clear();
+
+        auto width  = image->width;
+        auto height = image->height;
+        for (auto i = 0; valid && i < image->level_count; i++) {
+            u32 size = 0;
+            if (end - cursor >= 4) memcpy(&size, cursor, 4);
+            cursor += 4;
+            // A level that does not match its format's size for the level's
+            // dimensions would be read past by glCompressedTexImage2D
+            if (cursor > end || size > (u64)(end - cursor) ||
+                size != texture_level_size(image, width, height)) {
+                valid = false;
+                break;
+            }
+
+            auto& level  = image->levels[i];
+            level.width  = width;
+            level.height = height;
+            level.offset = image->data.size();
+            level.size   = size;
+            image->data.insert(image->data.end(), cursor, cursor + size);
+            cursor += size;
+
+            width  = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+        }
+    }
+
+    free(file.data);
+    return valid;
+}
+
+// Load the cooked version of a texture, cooking and caching it first if the
+// cache is missing or out of date.
+static bool texture_cache_load(const char* filename, TextureCook cook,
+                               TextureImage* image) {
+    String source{};
+    if (!file_read(filename, source)) return false;
+    auto hash = hash_fnv1a(source.data, source.length);
+    free(source.data);
+
+    auto path = texture_cache_path(filename, cook);
+    if (texture_cache_read(path.c_str(), hash, image)) return true;
+
+    if (!texture_cook(filename, cook, image)) return false;
+    if (!texture_cache_write(path.c_str(), image, hash)) {
+        fprintf(stderr, "Writing texture cache failed: '%s'\n", path.c_str());
+    }
+    return true;
+}
+
+struct Texture;
+
+// One entry of a batch load. The workers fill in image and loaded, the
+// texture is created afterwards on the thread that owns the GL context.
+struct TextureLoad {
+    const char* filename;
+    Texture* texture;
+    TextureCook cook{TEXTURE_COOK_COMPRESSED};
+
+    TextureImage image{};
+    bool loaded{false};
+};
+
+// Decode or read the cooked images of a batch in parallel on the pool
+static void texture_decode_batch(TextureLoad* loads, int count,
+                                 ThreadPool* pool) {
+    for (auto i = 0; i < count; i++) {
+        auto load = &loads[i];
+        thread_pool_submit(pool, [load] {
+            load->loaded =
+                texture_cache_load(load->filename, load->cook, &load->image);
+        });
+    }
+    thread_pool_wait(pool);
+}
+
+#endif
@@ -0,0 +1,287 @@
+#pragma once
+#if !defined(TEXTURE_STREAM_H)
+#define TEXTURE_STREAM_H
+
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "texture.h"
+#include "thread_pool.h"
+
+// Streamed textures start with only their coarsest levels resident and get
+// finer levels from the cook cache as they grow on screen. When the resident
+// levels of all streamed textures go over the budget, the finest levels of the
+// least recently used textures are dropped again.
+
+#define TEXTURE_STREAM_TAIL_SIZE 64
+#define TEXTURE_STREAM_BUDGET (4 * 1024 * 1024)
+
+struct TextureStreamRequest {
+    int level; // Finest level wanted when the request was made
+    TextureImage image{};
+    bool loaded{false};
+    std::atomic<bool> done{false};
+};
+
+struct StreamedTexture {
+    Texture* texture;
+    const char* name;
+
+    // Produces the cooked image, called on the pool
+    std::function<bool(TextureImage*)> load;
+
+    u32 internal_format;
+    bool compressed;
+    int level_count;
+    int widths[TEXTURE_MAX_LEVELS];
+    int heights[TEXTURE_MAX_LEVELS];
+    u64 sizes[TEXTURE_MAX_LEVELS];
+
+    int resident_level; // Finest level in video memory
+    int tail_level;     // Coarsest levels, loaded at startup and never dropped
+    int wanted_level;   // Finest level asked for during the current frame
+    u64 last_used_frame;
+
+    std::unique_ptr<TextureStreamRequest> request;
+};
+
+struct TextureStreamer {
+    std::vector<std::unique_ptr<StreamedTexture>> textures;
+    ThreadPool* pool;
+
+    float pixels_per_unit; // Screen pixels covered by one unit at distance one
+    u64 budget{TEXTURE_STREAM_BUDGET};
+    u64 resident_bytes{0};
+    u64 frame{0};
+
+    int uploads{0};
+    int evictions{0};
+};
+
+static void texture_stream_add(TextureStreamer* streamer, Texture* texture,
+                               const char* name,
+                               std::function<bool(TextureImage*)> load) {
+    auto streamed     = std::make_unique<StreamedTexture>();
+    streamed->texture = texture;
+    streamed->name    = name;
+    streamed->load    = std::move(load);
+    streamer->textures.push_back(std::move(streamed));
+}
+
+// A minimized window has no height, the view it had before is kept
+static void texture_stream_set_view(TextureStreamer* streamer, float fov_y,
+                                    float viewport_height) {
+    if (viewport_height <= 0.0f) return;
+    streamer->pixels_per_unit = viewport_height / (2.0f * tanf(fov_y / 2.0f));
+}
+
+// Specify levels [first, last) of a streamed texture from a cooked image
+static void texture_stream_upload(TextureStreamer* streamer,
+                                  StreamedTexture* streamed,
+                                  TextureImage const* image, int first,
+                                  int last) {
+    gl_state_bind_texture(0, GL_TEXTURE_2D, streamed->texture->id);
+    for (auto i = first; i < last; i++) {
+        auto& level = image->levels[i];
+        auto pixels = &image->data[level.offset];
+        if (image->compressed) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, image->internal_format,
+                                   level.width, level.height, 0, level.size,
+                                   pixels);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, i, image->internal_format, level.width,
+                         level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        }
+        streamer->resident_bytes += level.size;
+    }
+
+    streamed->resident_level = first;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, first);
+    streamer->uploads++;
+}
+
+// Drop the finest resident level of a streamed texture
+static void texture_stream_evict(TextureStreamer* streamer,
+                                 StreamedTexture* streamed) {
+    auto level = streamed->resident_level++;
+
+    gl_state_bind_texture(0, GL_TEXTURE_2D, streamed->texture->id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL,
+                    streamed->resident_level);
+
+    // Respecifying the level as empty releases its storage
+    if (streamed->compressed) {
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, streamed->internal_format,
+                               0, 0, 0, 0, NULL);
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, level, streamed->internal_format, 0, 0, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+
+    streamer->resident_bytes -= streamed->sizes[level];
+    streamer->evictions++;
+}
+
+// Evict fine levels of textures that were not used this frame, least recently
+// used first, until the given number of bytes fits in the budget.
+static bool texture_stream_make_room(TextureStreamer* streamer, u64 bytes) {
+    while (streamer->resident_bytes + bytes > streamer->budget) {
+        StreamedTexture* victim = nullptr;
+        for (auto& streamed : streamer->textures) {
+            if (streamed->resident_level >= streamed->tail_level) continue;
+            if (streamed->last_used_frame == streamer->frame) continue;
+            if (!victim || streamed->last_used_frame < victim->last_used_frame)
+                victim = streamed.get();
+        }
+
+        if (!victim) return false;
+        texture_stream_evict(streamer, victim);
+    }
+
+    return true;
+}
+
+// Load the tail of every added texture. Decoding runs on the pool, and only
+// the coarse levels are uploaded so startup does not wait on the fine ones.
+static void texture_stream_start(TextureStreamer* streamer, ThreadPool* pool) {
+    streamer->pool = pool;
+
+    auto count = (int)streamer->textures.size();
+    std::vector<TextureStreamRequest> requests(count);
+    for (auto i = 0; i < count; i++) {
+        auto streamed = streamer->textures[i].get();
+        auto request  = &requests[i];
+        thread_pool_submit(pool, [streamed, request] {
+            request->loaded = streamed->load(&request->image);
+        });
+    }
+    thread_pool_wait(pool);
+
+    for (auto i = 0; i < count; i++) {
+        auto streamed = streamer->textures[i].get();
+        auto& image   = requests[i].image;
+        if (!requests[i].loaded) {
+            error("Loading texture failed: '%s'\n", streamed->name);
+        }
+
+        streamed->internal_format = image.internal_format;
+        streamed->compressed      = image.compressed;
+        streamed->level_count     = image.level_count;
+        streamed->tail_level      = image.level_count - 1;
+        for (auto level = 0; level < image.level_count; level++) {
+            streamed->widths[level]  = image.levels[level].width;
+            streamed->heights[level] = image.levels[level].height;
+            streamed->sizes[level]   = image.levels[level].size;
+
+            auto size = std::max(image.levels[level].width,
+                                 image.levels[level].height);
+            if (size <= TEXTURE_STREAM_TAIL_SIZE)
+                streamed->tail_level = std::min(streamed->tail_level, level);
+        }
+        streamed->wanted_level = streamed->tail_level;
+
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        gl_state_bind_texture(0, GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                        GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                        image.level_count - 1);
+        *streamed->texture = {nullptr, image.width, image.height, texture};
+
+        texture_stream_upload(streamer, streamed, &image, streamed->tail_level,
+                              image.level_count);
+    }
+}
+
+// Ask for the level of a texture that suits an object of the given world size
+// seen from the given distance. Call for every use during a frame. Pass the
+// texels the object uses when it only covers part of the texture, as with
+// atlas entries.
+static void texture_stream_touch(TextureStreamer* streamer, Texture* texture,
+                                 float distance, float world_size,
+                                 float texels = 0.0f) {
+    for (auto& streamed : streamer->textures) {
+        if (streamed->texture != texture) continue;
+
+        // Kept above zero, so that the level below stays finite even
+        // before there is a view
+        auto pixels = std::max(world_size * streamer->pixels_per_unit /
+                                   std::max(distance, 0.01f),
+                               1e-3f);
+        if (texels <= 0.0f)
+            texels = (float)std::max(texture->width, texture->height);
+        auto level = (int)floorf(log2f(std::max(texels / pixels, 1.0f)));
+
+        streamed->wanted_level =
+            std::min(streamed->wanted_level, std::max(level, 0));
+        streamed->last_used_frame = streamer->frame;
+        return;
+    }
+}
+
+// Upload finished requests, start new ones for the levels wanted this frame
+// and move on to the next frame.
+static void texture_stream_update(TextureStreamer* streamer) {
+    for (auto& entry : streamer->textures) {
+        auto streamed = entry.get();
+
+        auto& request = streamed->request;
+        if (request && request->done.load(std::memory_order_acquire)) {
+            if (!request->loaded) {
+                error("Loading texture failed: '%s'\n", streamed->name);
+            }
+
+            // Nothing drew the texture this frame, as when a menu shows a
+            // cached scene, so the level it was requested for still stands.
+            // Uploading it counts as a use, which keeps the texture from
+            // making room out of its own levels.
+            auto wanted = streamed->wanted_level;
+            if (streamed->last_used_frame != streamer->frame) {
+                wanted                    = request->level;
+                streamed->last_used_frame = streamer->frame;
+            }
+
+            // Upload as much of the request as the budget allows, with room
+            // for every level taken so far
+            auto first  = streamed->resident_level;
+            u64 pending = 0;
+            while (first > wanted &&
+                   texture_stream_make_room(
+                       streamer, pending + streamed->sizes[first - 1])) {
+                pending += streamed->sizes[first - 1];
+                first--;
+            }
+
+            if (first < streamed->resident_level) {
+                texture_stream_upload(streamer, streamed, &request->image,
+                                      first, streamed->resident_level);
+            }
+            request.reset();
+        }
+
+        if (!request && streamed->wanted_level < streamed->resident_level) {
+            request        = std::make_unique<TextureStreamRequest>();
+            request->level = streamed->wanted_level;
+            auto job       = request.get();
+            thread_pool_submit(streamer->pool, [streamed, job] {
+                job->loaded = streamed->load(&job->image);
+                job->done.store(true, std::memory_order_release);
+            });
+        }
+
+        streamed->wanted_level = streamed->tail_level;
+    }
+
+    // The budget may have been lowered at runtime
+    texture_stream_make_room(streamer, 0);
+    streamer->frame++;
+}
+
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+#if !defined(THREAD_POOL_H)
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ThreadPool {
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable job_added;
+    std::condition_variable job_finished;
+    int running{0};
+    bool stopping{false};
+};
+
+static void thread_pool_work(ThreadPool* pool) {
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    while (true) {
+        pool->job_added.wait(
+            lock, [pool] { return pool->stopping || !pool->jobs.empty(); });
+        if (pool->jobs.empty()) return;
+
+        auto job = std::move(pool->jobs.front());
+        pool->jobs.pop_front();
+        pool->running++;
+
+        lock.unlock();
+        job();
+        lock.lock();
+
+        pool->running--;
+        pool->job_finished.notify_all();
+    }
+}
+
+// Start the workers. A thread count of zero uses one worker per core.
+static void thread_pool_create(ThreadPool* pool, int thread_count = 0) {
+    if (thread_count <= 0) {
+        thread_count = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+
+    pool->stopping = false;
+    for (auto i = 0; i < thread_count; i++) {
+        pool->workers.emplace_back(thread_pool_work, pool);
+    }
+}
+
+static void thread_pool_submit(ThreadPool* pool, std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->jobs.push_back(std::move(job));
+    }
+    pool->job_added.notify_one();
+}
+
+// Block until every submitted job has finished
+static void thread_pool_wait(ThreadPool* pool) {
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->job_finished.wait(
+        lock, [pool] { return pool->jobs.empty() && pool->running == 0; });
+}
+
+// Finish the queued jobs and join the workers
+static void thread_pool_destroy(ThreadPool* pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->stopping = true;
+    }
+    pool->job_added.notify_all();
+
+    for (auto& worker : pool->workers) worker.join();
+    pool->workers.clear();
+}
+
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+#if !defined(UNIFORM_BUFFER_H)
+#define UNIFORM_BUFFER_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "gl_state.h"
+#include "type.h"
+
+// A uniform buffer bound to a fixed binding point. Shaders are attached to the
+// binding point with shaderBindBlock once after compiling, so drawing never
+// has to rebind a buffer that is alone on its binding point. Buffers that
+// share one, like the materials, are bound with uniform_buffer_bind.
+
+// Binding points of the blocks shared by the shaders
+#define UNIFORM_BINDING_CAMERA 0
+#define UNIFORM_BINDING_LIGHTS 1
+#define UNIFORM_BINDING_MATERIAL 2
+
+struct UniformBuffer {
+    u32 id;
+    u32 binding;
+    u64 size;
+};
+
+static UniformBuffer uniform_buffer_create(u32 binding, u64 size) {
+    UniformBuffer buffer{0, binding, size};
+    glGenBuffers(1, &buffer.id);
+    gl_state_bind_buffer(GL_UNIFORM_BUFFER, buffer.id);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+    gl_state_bind_uniform_base(binding, buffer.id);
+    return buffer;
+}
+
+static void uniform_buffer_bind(UniformBuffer* buffer) {
+    gl_state_bind_uniform_base(buffer->binding, buffer->id);
+}
+
+// Replace the whole contents of the buffer. The data must follow the std140
+// layout of the block.
+static void uniform_buffer_write(UniformBuffer* buffer, const void* data) {
+    gl_state_bind_buffer(GL_UNIFORM_BUFFER, buffer->id);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, buffer->size, data);
+}
+
+#endif
@@ -7,8 +7,6 @@
 
 #include <vector>
 
-#include "model.h"
-
 struct Wall {
     glm::vec3 position;
     glm::vec3 scale;